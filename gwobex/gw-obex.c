@@ -33,6 +33,7 @@
 #include "gw-obex.h"
 #include "utils.h"
 #include "obex-xfer.h"
+#include "obex-archive.h"
 #include "obex-priv.h"
 
 
@@ -247,6 +248,47 @@ gboolean gw_obex_copy(GwObex *ctx, const gchar *src, const gchar *dst, gint *err
     return ret;
 }
 
+gboolean gw_obex_get_archive(GwObex *ctx, const gchar *local,
+                             const gchar *remote, gint *error) {
+    struct gw_obex_archive *ar;
+    GwObexXfer *xfer;
+    gboolean ret = TRUE;
+    gint bytes;
+
+    xfer = gw_obex_get_async(ctx, remote, TAR_TYPE, error);
+    if (xfer == NULL)
+        return FALSE;
+
+    gw_obex_xfer_set_blocking(xfer, TRUE);
+
+    /* Members are unpacked as the data comes in, only the current
+     * block is kept in memory */
+    ar = gw_obex_archive_new(local);
+
+    while (ret) {
+        char buf[GW_OBEX_RX_MTU];
+
+        ret = gw_obex_xfer_read(xfer, buf, sizeof(buf), &bytes, error);
+        if (ret == FALSE || bytes == 0)
+            break;
+
+        ret = gw_obex_archive_write(ar, buf, bytes, error);
+    }
+
+    if (ret)
+        ret = gw_obex_archive_finish(ar, error);
+
+    if (ret)
+        ret = gw_obex_xfer_close(xfer, error);
+    else
+        gw_obex_xfer_abort(xfer, NULL);
+
+    gw_obex_xfer_free(xfer);
+    gw_obex_archive_free(ar);
+
+    return ret;
+}
+
 gboolean gw_obex_get_capability(GwObex *ctx, gchar **cap, gint *cap_len, gint *error) {
     gboolean ret;
     GW_OBEX_LOCK(ctx);
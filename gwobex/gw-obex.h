@@ -285,6 +285,25 @@ gboolean gw_obex_get_file(GwObex *ctx,
                           gint *error);
 
 
+/** Get a whole folder tree from the remote device.
+ * The tree is received as one archive which is unpacked while it is
+ * transferred, so it never needs to be stored locally as a whole.
+ *
+ * @param ctx    Pointer returned by gw_obex_setup()
+ * @param local  Local directory where the folder is created
+ * @param remote Remote folder name (null terminated UTF-8), or NULL for
+ *               the current folder
+ * @param error  Place to store error code on failure
+ *               (NULL if not interested)
+ *
+ * @returns TRUE on success, FALSE on failure
+ */
+gboolean gw_obex_get_archive(GwObex *ctx,
+                             const gchar *local,
+                             const gchar *remote,
+                             gint *error);
+
+
 /** Send a file to the remote device.
  *
  * @param ctx    Pointer returned by gw_obex_setup()
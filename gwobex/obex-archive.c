@@ -0,0 +1,373 @@
+/**
+  @file obex-archive.c
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License, version 2.1, as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "log.h"
+#include "gw-obex.h"
+#include "obex-archive.h"
+
+#define ARCHIVE_BLOCK 512
+
+/* Longest GNU long name accepted */
+#define ARCHIVE_MAX_NAME 4096
+
+struct archive_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+struct gw_obex_archive {
+    /* Directory the archive is unpacked into */
+    gchar          *dir;
+
+    /* Header being received */
+    char            block[ARCHIVE_BLOCK];
+    gsize           block_len;
+
+    /* Data left of the current member and the padding after it */
+    guint64         remaining;
+    gsize           padding;
+
+    /* File the member data goes into, -1 if it is skipped */
+    int             fd;
+    time_t          mtime;
+
+    /* GNU long name being received, and the one for the next member */
+    GString        *longname;
+    gchar          *next_name;
+
+    /* TRUE once the end of archive marker was seen */
+    gboolean        end;
+};
+
+struct gw_obex_archive *gw_obex_archive_new(const gchar *dir) {
+    struct gw_obex_archive *ar;
+
+    ar = g_new0(struct gw_obex_archive, 1);
+    ar->dir = g_strdup(dir);
+    ar->fd = -1;
+
+    return ar;
+}
+
+void gw_obex_archive_free(struct gw_obex_archive *ar) {
+    if (ar->fd >= 0)
+        close(ar->fd);
+    if (ar->longname)
+        g_string_free(ar->longname, TRUE);
+    g_free(ar->next_name);
+    g_free(ar->dir);
+    g_free(ar);
+}
+
+static guint64 archive_number(const char *field, gsize size) {
+    char buf[16];
+    guint64 value = 0;
+    gsize i;
+
+    /* GNU base-256 extension */
+    if (field[0] & 0x80) {
+        for (i = 1; i < size; i++)
+            value = (value << 8) | (unsigned char) field[i];
+        return value;
+    }
+
+    memcpy(buf, field, size);
+    buf[size] = '\0';
+
+    return strtoull(buf, NULL, 8);
+}
+
+static gboolean archive_checksum(struct archive_header *hdr) {
+    unsigned char *p = (unsigned char *) hdr;
+    unsigned int sum = 0;
+    gsize i;
+
+    for (i = 0; i < sizeof(*hdr); i++) {
+        if (p + i >= (unsigned char *) hdr->chksum &&
+                p + i < (unsigned char *) hdr->chksum + sizeof(hdr->chksum))
+            sum += ' ';
+        else
+            sum += p[i];
+    }
+
+    return sum == archive_number(hdr->chksum, sizeof(hdr->chksum));
+}
+
+/* Member names come from the remote device, never let them point
+ * outside of the target directory */
+static gboolean archive_safe_name(const gchar *name) {
+    gchar **parts;
+    gboolean ret = TRUE;
+    int i;
+
+    if (name[0] == '\0' || name[0] == '/')
+        return FALSE;
+
+    parts = g_strsplit(name, "/", -1);
+    for (i = 0; parts[i]; i++) {
+        if (strcmp(parts[i], "..") == 0) {
+            ret = FALSE;
+            break;
+        }
+    }
+    g_strfreev(parts);
+
+    return ret;
+}
+
+static gchar *archive_name(struct gw_obex_archive *ar,
+                           struct archive_header *hdr) {
+    gchar *name, *prefix, *full;
+
+    if (ar->next_name) {
+        name = ar->next_name;
+        ar->next_name = NULL;
+        return name;
+    }
+
+    name = g_strndup(hdr->name, sizeof(hdr->name));
+
+    if (memcmp(hdr->magic, "ustar", 5) != 0 || hdr->prefix[0] == '\0')
+        return name;
+
+    prefix = g_strndup(hdr->prefix, sizeof(hdr->prefix));
+    full = g_strconcat(prefix, "/", name, NULL);
+    g_free(prefix);
+    g_free(name);
+
+    return full;
+}
+
+static gboolean archive_open_file(struct gw_obex_archive *ar,
+                                  const gchar *path, mode_t mode) {
+    gchar *parent;
+
+    parent = g_path_get_dirname(path);
+    if (g_mkdir_with_parents(parent, 0755) < 0) {
+        debug("Unable to create %s: %s\n", parent, strerror(errno));
+        g_free(parent);
+        return FALSE;
+    }
+    g_free(parent);
+
+    ar->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+                  mode ? mode : 0644);
+    if (ar->fd < 0) {
+        debug("Unable to create %s: %s\n", path, strerror(errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void archive_close_file(struct gw_obex_archive *ar) {
+    struct timeval tv[2];
+
+    tv[0].tv_sec = tv[1].tv_sec = ar->mtime;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    if (futimes(ar->fd, tv) < 0)
+        debug("futimes: %s\n", strerror(errno));
+
+    close(ar->fd);
+    ar->fd = -1;
+}
+
+static gboolean archive_header(struct gw_obex_archive *ar, gint *error) {
+    struct archive_header *hdr = (struct archive_header *) ar->block;
+    gboolean ret = TRUE;
+    gchar *name, *path;
+    mode_t mode;
+    gsize i;
+
+    for (i = 0; i < sizeof(ar->block); i++) {
+        if (ar->block[i] != '\0')
+            break;
+    }
+
+    if (i == sizeof(ar->block)) {
+        ar->end = TRUE;
+        return TRUE;
+    }
+
+    if (!archive_checksum(hdr)) {
+        debug("Invalid archive header checksum\n");
+        if (error)
+            *error = GW_OBEX_ERROR_INVALID_DATA;
+        return FALSE;
+    }
+
+    ar->remaining = archive_number(hdr->size, sizeof(hdr->size));
+    ar->padding = (ARCHIVE_BLOCK - ar->remaining % ARCHIVE_BLOCK) % ARCHIVE_BLOCK;
+    ar->mtime = archive_number(hdr->mtime, sizeof(hdr->mtime));
+    mode = archive_number(hdr->mode, sizeof(hdr->mode)) & 0777;
+
+    if (hdr->typeflag == 'L') {
+        if (ar->remaining == 0 || ar->remaining > ARCHIVE_MAX_NAME) {
+            if (error)
+                *error = GW_OBEX_ERROR_INVALID_DATA;
+            return FALSE;
+        }
+        ar->longname = g_string_sized_new(ar->remaining);
+        return TRUE;
+    }
+
+    name = archive_name(ar, hdr);
+    if (!archive_safe_name(name)) {
+        debug("Refusing to unpack %s\n", name);
+        g_free(name);
+        if (error)
+            *error = GW_OBEX_ERROR_INVALID_DATA;
+        return FALSE;
+    }
+
+    path = g_build_filename(ar->dir, name, NULL);
+
+    switch (hdr->typeflag) {
+    case '5':
+        if (g_mkdir_with_parents(path, mode ? mode : 0755) < 0) {
+            debug("Unable to create %s: %s\n", path, strerror(errno));
+            ret = FALSE;
+        }
+        break;
+    case '0':
+    case '\0':
+    case '7':
+        ret = archive_open_file(ar, path, mode);
+        if (ret && ar->remaining == 0)
+            archive_close_file(ar);
+        break;
+    default:
+        /* Links and special files could point anywhere, skip them */
+        debug("Skipping %s (type %c)\n", name, hdr->typeflag);
+        break;
+    }
+
+    if (!ret && error)
+        *error = GW_OBEX_ERROR_LOCAL_ACCESS;
+
+    g_free(path);
+    g_free(name);
+
+    return ret;
+}
+
+static gboolean archive_data(struct gw_obex_archive *ar, const char *buf,
+                             gsize len, gint *error) {
+    if (ar->longname) {
+        g_string_append_len(ar->longname, buf, len);
+        if (ar->remaining == 0) {
+            g_free(ar->next_name);
+            ar->next_name = g_strndup(ar->longname->str, ar->longname->len);
+            g_string_free(ar->longname, TRUE);
+            ar->longname = NULL;
+        }
+        return TRUE;
+    }
+
+    if (ar->fd < 0)
+        return TRUE;
+
+    while (len > 0) {
+        ssize_t written = write(ar->fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            debug("write: %s\n", strerror(errno));
+            if (error)
+                *error = GW_OBEX_ERROR_LOCAL_ACCESS;
+            return FALSE;
+        }
+        buf += written;
+        len -= written;
+    }
+
+    if (ar->remaining == 0)
+        archive_close_file(ar);
+
+    return TRUE;
+}
+
+gboolean gw_obex_archive_write(struct gw_obex_archive *ar, const char *buf,
+                               gint len, gint *error) {
+    gsize n;
+
+    while (len > 0 && !ar->end) {
+        if (ar->remaining > 0) {
+            n = MIN((guint64) len, ar->remaining);
+            ar->remaining -= n;
+            if (!archive_data(ar, buf, n, error))
+                return FALSE;
+        }
+        else if (ar->padding > 0) {
+            n = MIN((gsize) len, ar->padding);
+            ar->padding -= n;
+        }
+        else {
+            n = MIN((gsize) len, sizeof(ar->block) - ar->block_len);
+            memcpy(ar->block + ar->block_len, buf, n);
+            ar->block_len += n;
+            if (ar->block_len == sizeof(ar->block)) {
+                ar->block_len = 0;
+                if (!archive_header(ar, error))
+                    return FALSE;
+            }
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+gboolean gw_obex_archive_finish(struct gw_obex_archive *ar, gint *error) {
+    if (ar->end)
+        return TRUE;
+
+    debug("Archive ended prematurely\n");
+    if (error)
+        *error = GW_OBEX_ERROR_INVALID_DATA;
+
+    return FALSE;
+}
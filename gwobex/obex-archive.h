@@ -0,0 +1,52 @@
+/**
+  @file obex-archive.h
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License, version 2.1, as published by the Free Software Foundation.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA 02111-1307, USA.
+
+*/
+#ifndef _OBEX_ARCHIVE_H_
+#define _OBEX_ARCHIVE_H_
+
+#include <glib.h>
+
+/* Unpacks a ustar stream into a local directory as it is received */
+struct gw_obex_archive;
+
+/** Start unpacking an archive
+ * @param dir Local directory where the members are created
+ * @returns a new unpacker
+ */
+struct gw_obex_archive *gw_obex_archive_new(const gchar *dir);
+
+/** Unpack the next part of the archive
+ * @param ar    Unpacker returned by gw_obex_archive_new()
+ * @param buf   Data received, of any size
+ * @param len   Length of the data
+ * @param error Place to store error code on failure
+ * @returns TRUE on success, FALSE on failure
+ */
+gboolean gw_obex_archive_write(struct gw_obex_archive *ar, const char *buf,
+                               gint len, gint *error);
+
+/** Check that the whole archive has been unpacked
+ * @param ar    Unpacker returned by gw_obex_archive_new()
+ * @param error Place to store error code on failure
+ * @returns TRUE if the archive was complete, FALSE otherwise
+ */
+gboolean gw_obex_archive_finish(struct gw_obex_archive *ar, gint *error);
+
+void gw_obex_archive_free(struct gw_obex_archive *ar);
+
+#endif /* _OBEX_ARCHIVE_H_ */
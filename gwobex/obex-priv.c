@@ -621,6 +621,12 @@ gboolean gw_obex_transport_setup(int fd, obex_t **handle) {
 
     (void) OBEX_SetTransportMTU(*handle, GW_OBEX_RX_MTU, GW_OBEX_TX_MTU);
 
+#ifdef HAVE_OBEX_SRM
+    /* Request SRM on GET and PUT, falls back to normal mode when
+     * the server does not enable it */
+    OBEX_SetReponseMode(*handle, OBEX_RSP_MODE_SINGLE);
+#endif
+
     if (FdOBEX_TransportSetup(*handle, fd, fd, 0) < 0) {
         debug("FdOBEX_TransportSetup() failed\n");
         OBEX_Cleanup(*handle);
@@ -71,6 +71,7 @@
 #define CAP_TYPE "x-obex/capability"
 #define OBP_TYPE "x-obex/object-profile"
 #define LST_TYPE "x-obex/folder-listing"
+#define TAR_TYPE "application/x-tar"
 
 #ifdef GW_OBEX_THREADS_ENABLED
 # ifdef DEBUG
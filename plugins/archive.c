@@ -0,0 +1,420 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "filesystem.h"
+#include "archive.h"
+
+/* Whole folder trees are sent as a ustar archive which is generated while
+ * it is read: the only state kept is the stack of open directories down
+ * to the current entry, the headers of that entry and the descriptor of
+ * the file whose data is being copied. */
+#define ARCHIVE_BLOCK 512
+#define ARCHIVE_LONGNAME "././@LongLink"
+
+struct archive_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+};
+
+struct archive_dir {
+	DIR *dp;
+	char *path;
+};
+
+struct folder_archive {
+	GSList *dirs;
+	struct string_buffer *buffer;
+	int fd;
+	off_t remaining;
+	size_t padding;
+	gboolean trailer;
+};
+
+static void archive_octal(char *field, size_t size, uint64_t value)
+{
+	int i;
+
+	if (value < (1ULL << (3 * (size - 1)))) {
+		snprintf(field, size, "%0*" PRIo64, (int) size - 1, value);
+		return;
+	}
+
+	/* GNU base-256 extension for values without an octal form */
+	for (i = size - 1; i > 0; i--, value >>= 8)
+		field[i] = value & 0xff;
+
+	field[0] = 0x80;
+}
+
+static void archive_block(struct folder_archive *ar, char type,
+				const char *name, const struct stat *st,
+				uint64_t size, const char *link)
+{
+	struct archive_header hdr;
+	unsigned char *p = (unsigned char *) &hdr;
+	unsigned int sum = 0;
+	size_t i;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	strncpy(hdr.name, name, sizeof(hdr.name));
+	archive_octal(hdr.mode, sizeof(hdr.mode), st->st_mode & 07777);
+	archive_octal(hdr.uid, sizeof(hdr.uid), st->st_uid);
+	archive_octal(hdr.gid, sizeof(hdr.gid), st->st_gid);
+	archive_octal(hdr.size, sizeof(hdr.size), size);
+	archive_octal(hdr.mtime, sizeof(hdr.mtime), st->st_mtime);
+	hdr.typeflag = type;
+	if (link)
+		strncpy(hdr.linkname, link, sizeof(hdr.linkname));
+	memcpy(hdr.magic, "ustar", 6);
+	memcpy(hdr.version, "00", 2);
+
+	memset(hdr.chksum, ' ', sizeof(hdr.chksum));
+	for (i = 0; i < sizeof(hdr); i++)
+		sum += p[i];
+	snprintf(hdr.chksum, sizeof(hdr.chksum), "%06o", sum);
+
+	string_buffer_append(ar->buffer, (const char *) &hdr, sizeof(hdr));
+}
+
+static void archive_header(struct folder_archive *ar, char type,
+				const char *name, const struct stat *st,
+				uint64_t size, const char *link)
+{
+	static const char zero[ARCHIVE_BLOCK];
+	size_t len = strlen(name) + 1;
+
+	/* Names which do not fit the header are sent in a GNU long name
+	 * entry preceding it, which tar and the gwobex client understand */
+	if (len > sizeof(((struct archive_header *) NULL)->name)) {
+		archive_block(ar, 'L', ARCHIVE_LONGNAME, st, len, NULL);
+		string_buffer_append(ar->buffer, name, len);
+		string_buffer_append(ar->buffer, zero,
+				(ARCHIVE_BLOCK - len % ARCHIVE_BLOCK) %
+				ARCHIVE_BLOCK);
+	}
+
+	archive_block(ar, type, name, st, size, link);
+}
+
+static struct archive_dir *archive_push(struct folder_archive *ar, int dfd,
+							const char *path)
+{
+	struct archive_dir *dir;
+	DIR *dp;
+
+	dp = fdopendir(dfd);
+	if (dp == NULL) {
+		close(dfd);
+		return NULL;
+	}
+
+	dir = g_new0(struct archive_dir, 1);
+	dir->dp = dp;
+	dir->path = g_strconcat(path, "/", NULL);
+
+	ar->dirs = g_slist_prepend(ar->dirs, dir);
+
+	return dir;
+}
+
+static void archive_pop(struct folder_archive *ar)
+{
+	struct archive_dir *dir = ar->dirs->data;
+
+	ar->dirs = g_slist_delete_link(ar->dirs, ar->dirs);
+
+	closedir(dir->dp);
+	g_free(dir->path);
+	g_free(dir);
+}
+
+static void archive_free(struct folder_archive *ar)
+{
+	while (ar->dirs)
+		archive_pop(ar);
+
+	if (ar->fd >= 0)
+		close(ar->fd);
+
+	string_buffer_free(ar->buffer);
+	g_free(ar);
+}
+
+/* Queues the headers of the next entry of the tree, or the end of archive
+ * marker once every directory has been walked. Entries are opened and
+ * stat'ed relative to their directory and symlinks are never followed,
+ * they are archived as links. */
+static gboolean archive_next(struct folder_archive *ar)
+{
+	static const char zero[2 * ARCHIVE_BLOCK];
+
+	while (ar->dirs) {
+		struct archive_dir *dir = ar->dirs->data, *sub = NULL;
+		int dfd = dirfd(dir->dp);
+		char link[sizeof(((struct archive_header *) NULL)->linkname)];
+		struct dirent *ep;
+		struct stat st;
+		char *path;
+		ssize_t len;
+		int fd;
+
+		ep = readdir(dir->dp);
+		if (ep == NULL) {
+			archive_pop(ar);
+			continue;
+		}
+
+		if (ep->d_name[0] == '.')
+			continue;
+
+		if (fstatat(dfd, ep->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+			DBG("lstat: %s(%d)", strerror(errno), errno);
+			continue;
+		}
+
+		path = g_strconcat(dir->path, ep->d_name, NULL);
+
+		if (S_ISDIR(st.st_mode)) {
+			fd = openat(dfd, ep->d_name,
+					O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+			if (fd >= 0)
+				sub = archive_push(ar, fd, path);
+
+			if (sub == NULL) {
+				DBG("%s: %s(%d)", path, strerror(errno), errno);
+				g_free(path);
+				continue;
+			}
+
+			archive_header(ar, '5', sub->path, &st, 0, NULL);
+		} else if (S_ISREG(st.st_mode)) {
+			fd = openat(dfd, ep->d_name, O_RDONLY | O_NOFOLLOW);
+			if (fd < 0) {
+				DBG("%s: %s(%d)", path, strerror(errno), errno);
+				g_free(path);
+				continue;
+			}
+
+			archive_header(ar, '0', path, &st, st.st_size, NULL);
+
+			ar->fd = fd;
+			ar->remaining = st.st_size;
+			ar->padding = (ARCHIVE_BLOCK -
+					st.st_size % ARCHIVE_BLOCK) %
+					ARCHIVE_BLOCK;
+		} else if (S_ISLNK(st.st_mode)) {
+			len = readlinkat(dfd, ep->d_name, link, sizeof(link));
+			if (len < 0 || (size_t) len == sizeof(link)) {
+				g_free(path);
+				continue;
+			}
+
+			link[len] = '\0';
+			archive_header(ar, '2', path, &st, 0, link);
+		} else {
+			g_free(path);
+			continue;
+		}
+
+		g_free(path);
+
+		return TRUE;
+	}
+
+	if (ar->trailer)
+		return FALSE;
+
+	string_buffer_append(ar->buffer, zero, sizeof(zero));
+	ar->trailer = TRUE;
+
+	return TRUE;
+}
+
+void *archive_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct folder_archive *ar;
+	struct archive_dir *dir;
+	struct stat st;
+	char *base;
+	int fd;
+
+	if (oflag != O_RDONLY) {
+		if (err)
+			*err = -EPERM;
+		return NULL;
+	}
+
+	fd = open(name, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		if (err)
+			*err = -errno;
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		if (err)
+			*err = -errno;
+		close(fd);
+		return NULL;
+	}
+
+	ar = g_new0(struct folder_archive, 1);
+	ar->buffer = string_buffer_new(NULL);
+	ar->fd = -1;
+
+	/* Members are named relative to the parent of the archived folder
+	 * so that unpacking recreates the folder itself */
+	base = g_path_get_basename(name);
+	if (base[0] == '/' || base[0] == '.') {
+		g_free(base);
+		base = g_strdup("folder");
+	}
+
+	dir = archive_push(ar, fd, base);
+	g_free(base);
+
+	if (dir == NULL) {
+		if (err)
+			*err = -errno;
+		archive_free(ar);
+		return NULL;
+	}
+
+	archive_header(ar, '5', dir->path, &st, 0, NULL);
+
+	if (err)
+		*err = 0;
+
+	return ar;
+}
+
+int archive_close(void *object)
+{
+	archive_free(object);
+
+	return 0;
+}
+
+ssize_t archive_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
+{
+	struct folder_archive *ar = object;
+	char *data = buf;
+	size_t filled = 0;
+	ssize_t len;
+
+	if (flags)
+		*flags = 0;
+
+	*hi = OBEX_HDR_BODY;
+
+	while (filled < count) {
+		if (string_buffer_len(ar->buffer) > 0) {
+			filled += string_buffer_read(ar->buffer, data + filled,
+							count - filled);
+			continue;
+		}
+
+		if (ar->fd >= 0) {
+			len = MIN((off_t) (count - filled), ar->remaining);
+
+			len = read(ar->fd, data + filled, len);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+
+			/* The header is already out, pad a file which got
+			 * shorter since it was stat'ed */
+			if (len == 0) {
+				len = MIN((off_t) (count - filled),
+							ar->remaining);
+				memset(data + filled, 0, len);
+			}
+
+			filled += len;
+			ar->remaining -= len;
+
+			if (ar->remaining == 0) {
+				close(ar->fd);
+				ar->fd = -1;
+			}
+
+			continue;
+		}
+
+		if (ar->padding > 0) {
+			len = MIN(count - filled, ar->padding);
+			memset(data + filled, 0, len);
+			filled += len;
+			ar->padding -= len;
+			continue;
+		}
+
+		if (!archive_next(ar))
+			break;
+	}
+
+	return filled;
+}
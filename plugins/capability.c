@@ -0,0 +1,413 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <wait.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "obex.h"
+#include "mimetype.h"
+#include "filesystem.h"
+#include "capability.h"
+
+/* Capability objects are requested by most clients right after they
+ * connect. The rendered object is kept until the file changes, script
+ * output for CAPABILITY_SCRIPT_TTL seconds, so repeated queries neither
+ * read the file again nor fork. */
+#define CAPABILITY_SCRIPT_TTL 30
+
+struct capability_entry {
+	char *data;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t expires;
+};
+
+struct capability_object {
+	int pid;
+	int output;
+	int err;
+	gboolean aborted;
+	struct string_buffer *buffer;
+	char *name;
+	GTimer *timer;
+};
+
+static GHashTable *capability_cache = NULL;
+static unsigned int capability_hits = 0;
+static unsigned int capability_misses = 0;
+static double capability_hit_time = 0;
+static double capability_miss_time = 0;
+G_LOCK_DEFINE_STATIC(capability_cache);
+
+static void capability_entry_free(void *data)
+{
+	struct capability_entry *entry = data;
+
+	g_free(entry->data);
+	g_free(entry);
+}
+
+/* Returns a copy of the cached object, st is NULL for script output */
+static char *capability_cache_lookup(const char *name, struct stat *st)
+{
+	struct capability_entry *entry;
+	char *data = NULL;
+
+	G_LOCK(capability_cache);
+
+	if (capability_cache == NULL)
+		goto done;
+
+	entry = g_hash_table_lookup(capability_cache, name);
+	if (entry == NULL)
+		goto done;
+
+	if (st == NULL && time(NULL) >= entry->expires)
+		goto done;
+
+	if (st && (entry->dev != st->st_dev || entry->ino != st->st_ino ||
+			entry->size != st->st_size ||
+			entry->mtime != st->st_mtime))
+		goto done;
+
+	data = g_strdup(entry->data);
+
+done:
+	G_UNLOCK(capability_cache);
+
+	return data;
+}
+
+static void capability_cache_store(const char *name, const char *data,
+							struct stat *st)
+{
+	struct capability_entry *entry;
+
+	entry = g_new0(struct capability_entry, 1);
+	entry->data = g_strdup(data);
+
+	if (st) {
+		entry->dev = st->st_dev;
+		entry->ino = st->st_ino;
+		entry->size = st->st_size;
+		entry->mtime = st->st_mtime;
+	} else
+		entry->expires = time(NULL) + CAPABILITY_SCRIPT_TTL;
+
+	G_LOCK(capability_cache);
+
+	if (capability_cache == NULL)
+		capability_cache = g_hash_table_new_full(g_str_hash,
+					g_str_equal, g_free,
+					capability_entry_free);
+
+	g_hash_table_replace(capability_cache, g_strdup(name), entry);
+
+	G_UNLOCK(capability_cache);
+}
+
+/* Time from the request until the object can be read */
+static void capability_ready(struct capability_object *object,
+							gboolean hit)
+{
+	double elapsed = g_timer_elapsed(object->timer, NULL) * 1000;
+	unsigned int hits, misses;
+	double hit_time, miss_time;
+
+	G_LOCK(capability_cache);
+
+	if (hit) {
+		capability_hits++;
+		capability_hit_time += elapsed;
+	} else {
+		capability_misses++;
+		capability_miss_time += elapsed;
+	}
+
+	hits = capability_hits;
+	misses = capability_misses;
+	hit_time = capability_hit_time;
+	miss_time = capability_miss_time;
+
+	G_UNLOCK(capability_cache);
+
+	DBG("%s: %s in %.3f ms, %u hits (avg %.3f ms) %u misses "
+			"(avg %.3f ms)", object->name, hit ? "hit" : "miss",
+			elapsed, hits, hits ? hit_time / hits : 0, misses,
+			misses ? miss_time / misses : 0);
+}
+
+static void capability_free(struct capability_object *object)
+{
+	if (object->buffer != NULL)
+		string_buffer_free(object->buffer);
+
+	if (object->output >= 0)
+		close(object->output);
+
+	if (object->err >= 0)
+		close(object->err);
+
+	g_timer_destroy(object->timer);
+	g_free(object->name);
+	g_free(object);
+}
+
+void capability_cache_exit(void)
+{
+	if (capability_cache == NULL)
+		return;
+
+	DBG("capability cache: %u hits %u misses", capability_hits,
+							capability_misses);
+
+	g_hash_table_destroy(capability_cache);
+	capability_cache = NULL;
+}
+
+/* The script has exited, so its whole output is waiting in the pipe */
+static int capability_collect(struct capability_object *object)
+{
+	GString *output;
+	char buf[1024];
+	ssize_t len;
+
+	output = g_string_new(NULL);
+
+	while ((len = read(object->output, buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			g_string_free(output, TRUE);
+			return -errno;
+		}
+
+		g_string_append_len(output, buf, len);
+	}
+
+	capability_cache_store(object->name, output->str, NULL);
+	object->buffer = string_buffer_new(output->str);
+	g_string_free(output, TRUE);
+
+	return 0;
+}
+
+static void script_exited(GPid pid, int status, void *data)
+{
+	struct capability_object *object = data;
+	char buf[128];
+
+	object->pid = -1;
+
+	DBG("pid: %d status: %d", pid, status);
+
+	g_spawn_close_pid(pid);
+
+	/* free the object if aborted */
+	if (object->aborted) {
+		capability_free(object);
+		return;
+	}
+
+	if (WEXITSTATUS(status) != EXIT_SUCCESS) {
+		memset(buf, 0, sizeof(buf));
+		if (read(object->err, buf, sizeof(buf)) > 0)
+			error("%s", buf);
+		obex_object_set_io_flags(data, G_IO_ERR, -EPERM);
+	} else if (capability_collect(object) < 0)
+		obex_object_set_io_flags(data, G_IO_ERR, -EPERM);
+	else {
+		capability_ready(object, FALSE);
+		obex_object_set_io_flags(data, G_IO_IN, 0);
+	}
+}
+
+static int capability_exec(const char **argv, int *output, int *err)
+{
+	GError *gerr = NULL;
+	int pid;
+	GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH;
+
+	if (!g_spawn_async_with_pipes(NULL, (char **) argv, NULL, flags, NULL,
+				NULL, &pid, NULL, output, err, &gerr)) {
+		error("%s", gerr->message);
+		g_error_free(gerr);
+		return -EPERM;
+	}
+
+	DBG("executing %s pid %d", argv[0], pid);
+
+	return pid;
+}
+
+void *capability_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct capability_object *object = NULL;
+	gboolean hit = TRUE;
+	struct stat st;
+	char *buf;
+	const char *argv[2];
+
+	if (oflag != O_RDONLY)
+		goto fail;
+
+	object = g_new0(struct capability_object, 1);
+	object->pid = -1;
+	object->output = -1;
+	object->err = -1;
+	object->name = g_strdup(name);
+	object->timer = g_timer_new();
+
+	if (name[0] != '!') {
+		GError *gerr = NULL;
+		gboolean ret;
+
+		if (stat(name, &st) < 0) {
+			error("%s: %s (%d)", name, strerror(errno), errno);
+			goto fail;
+		}
+
+		buf = capability_cache_lookup(name, &st);
+		if (buf == NULL) {
+			hit = FALSE;
+
+			ret = g_file_get_contents(name, &buf, NULL, &gerr);
+			if (ret == FALSE) {
+				error("%s", gerr->message);
+				g_error_free(gerr);
+				goto fail;
+			}
+
+			capability_cache_store(name, buf, &st);
+		}
+
+		goto ready;
+	}
+
+	buf = capability_cache_lookup(name, NULL);
+	if (buf)
+		goto ready;
+
+	argv[0] = &name[1];
+	argv[1] = NULL;
+
+	object->pid = capability_exec(argv, &object->output, &object->err);
+	if (object->pid < 0)
+		goto fail;
+
+	/* Watch cannot be removed while the process is still running */
+	g_child_watch_add(object->pid, script_exited, object);
+
+	goto done;
+
+ready:
+	object->buffer = string_buffer_new(buf);
+	g_free(buf);
+
+	if (size)
+		*size = string_buffer_len(object->buffer);
+
+	capability_ready(object, hit);
+
+done:
+	if (err)
+		*err = 0;
+
+	return object;
+
+fail:
+	if (err)
+		*err = -EPERM;
+
+	if (object)
+		capability_free(object);
+
+	return NULL;
+}
+
+ssize_t capability_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
+{
+	struct capability_object *obj = object;
+
+	if (flags)
+		*flags = 0;
+
+	*hi = OBEX_HDR_BODY;
+
+	if (obj->buffer)
+		return string_buffer_read(obj->buffer, buf, count);
+
+	if (obj->pid >= 0)
+		return -EAGAIN;
+
+	return read(obj->output, buf, count);
+}
+
+int capability_close(void *object)
+{
+	struct capability_object *obj = object;
+	int err = 0;
+
+	if (obj->pid < 0)
+		goto done;
+
+	DBG("kill: pid %d", obj->pid);
+	err = kill(obj->pid, SIGTERM);
+	if (err < 0) {
+		err = -errno;
+		error("kill: %s (%d)", strerror(-err), -err);
+		goto done;
+	}
+
+	obj->aborted = TRUE;
+	return 0;
+
+done:
+	capability_free(obj);
+
+	return err;
+}
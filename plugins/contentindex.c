@@ -0,0 +1,316 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "obex.h"
+#include "contentindex.h"
+
+/* Received files are hashed while they are written. The hash is kept in
+ * an extended attribute together with the size and mtime it was taken
+ * at, so it can be listed and trusted only as long as the file is left
+ * untouched. A symlink named after the hash in a hidden folder of the
+ * root points to the last file received with it, so an identical file
+ * received later can share its blocks once the kernel confirmed they
+ * hold the same bytes. Files stay separate inodes with their own
+ * permissions, on filesystems without shared extents nothing is shared.
+ * Removing a file frees its space, the stale symlink is replaced or
+ * pruned later. */
+#define CONTENT_INDEX_XATTR "user.obex.sha256"
+#define CONTENT_INDEX_FOLDER ".obex-index"
+
+static volatile gint content_index_share = TRUE;
+
+/* Size and mtime, to the nanosecond, of the file when it was hashed */
+static void content_index_stamp(struct stat *st, char *stamp, size_t len)
+{
+	snprintf(stamp, len, "%" PRIu64 ":%ld.%09ld:", (uint64_t) st->st_size,
+				(long) st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+}
+
+/* Reads the hash of the file name in the directory dfd, which must be
+ * the file st was taken with the fstatat() flags given. The attribute is
+ * read through the directory fd, the file is not opened. */
+int content_index_attr(int dfd, const char *name, int flags,
+				struct stat *st, char *hash, size_t len)
+{
+	char value[128], stamp[64], buf[32 + NAME_MAX + 1];
+	const char *path = name;
+	ssize_t ret;
+
+	if (dfd != AT_FDCWD) {
+		snprintf(buf, sizeof(buf), "/proc/self/fd/%d/%s", dfd, name);
+		path = buf;
+	}
+
+	if (flags & AT_SYMLINK_NOFOLLOW)
+		ret = lgetxattr(path, CONTENT_INDEX_XATTR, value,
+							sizeof(value) - 1);
+	else
+		ret = getxattr(path, CONTENT_INDEX_XATTR, value,
+							sizeof(value) - 1);
+	if (ret < 0)
+		return -errno;
+
+	value[ret] = '\0';
+
+	content_index_stamp(st, stamp, sizeof(stamp));
+
+	/* Written by something else since it was hashed */
+	if (!g_str_has_prefix(value, stamp))
+		return -ESTALE;
+
+	g_strlcpy(hash, value + strlen(stamp), len);
+
+	return 0;
+}
+
+static void content_index_store(int fd, struct stat *st, const char *hash)
+{
+	char stamp[64], *value;
+
+	content_index_stamp(st, stamp, sizeof(stamp));
+	value = g_strconcat(stamp, hash, NULL);
+
+	if (fsetxattr(fd, CONTENT_INDEX_XATTR, value, strlen(value), 0) < 0)
+		DBG("fsetxattr: %s(%d)", strerror(errno), errno);
+
+	g_free(value);
+}
+
+#ifdef FIDEDUPERANGE
+/* Shares the blocks of src with dst where the kernel finds both hold the
+ * same bytes. Returns -EBADE as soon as a range differs. */
+static int content_index_share_blocks(int src, int dst, off_t size)
+{
+	struct file_dedupe_range *range;
+	struct file_dedupe_range_info *info;
+	off_t offset = 0;
+	int err = 0;
+
+	range = g_malloc0(sizeof(*range) + sizeof(*info));
+	range->dest_count = 1;
+	info = &range->info[0];
+
+	/* Filesystems may do less than asked for in one call */
+	while (offset < size) {
+		range->src_offset = offset;
+		range->src_length = size - offset;
+		info->dest_fd = dst;
+		info->dest_offset = offset;
+
+		if (ioctl(src, FIDEDUPERANGE, range) < 0) {
+			err = -errno;
+			break;
+		}
+
+		if (info->status == FILE_DEDUPE_RANGE_DIFFERS) {
+			err = -EBADE;
+			break;
+		}
+
+		if (info->status < 0) {
+			err = info->status;
+			break;
+		}
+
+		if (info->bytes_deduped == 0)
+			break;
+
+		offset += info->bytes_deduped;
+	}
+
+	g_free(range);
+
+	return err;
+}
+#endif
+
+static char *content_index_folder(void)
+{
+	return g_build_filename(obex_option_root_folder(),
+					CONTENT_INDEX_FOLDER, NULL);
+}
+
+static void content_index_dedupe(int fd, const char *name, struct stat *st,
+							const char *hash)
+{
+#ifdef FIDEDUPERANGE
+	char *dir, *entry, *target;
+	char stored[65];
+	struct stat est;
+	int efd, err;
+
+	if (!g_atomic_int_get(&content_index_share))
+		return;
+
+	dir = content_index_folder();
+	entry = g_build_filename(dir, hash, NULL);
+
+	target = g_file_read_link(entry, NULL);
+	if (target == NULL)
+		goto add;
+
+	efd = open(target, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+	if (efd < 0)
+		goto add;
+
+	if (fstat(efd, &est) < 0 || !S_ISREG(est.st_mode))
+		goto replace;
+
+	if (est.st_dev != st->st_dev || est.st_ino == st->st_ino) {
+		close(efd);
+		goto done;
+	}
+
+	/* Removed, moved or written to since it was indexed */
+	if (est.st_size != st->st_size ||
+			content_index_attr(AT_FDCWD, target, AT_SYMLINK_NOFOLLOW,
+					&est, stored, sizeof(stored)) < 0 ||
+			!g_str_equal(stored, hash))
+		goto replace;
+
+	/* The kernel compares the data, a stale hash shares nothing */
+	err = content_index_share_blocks(efd, fd, st->st_size);
+
+	switch (err) {
+	case 0:
+		DBG("%s: same content as %s", name, target);
+		break;
+	case -EBADE:
+		DBG("%s: content changed since it was hashed", target);
+		goto replace;
+	case -EOPNOTSUPP:
+	case -ENOTTY:
+	case -EINVAL:
+		DBG("block sharing not supported, not sharing content");
+		g_atomic_int_set(&content_index_share, FALSE);
+		break;
+	default:
+		DBG("%s: %s(%d)", name, strerror(-err), -err);
+	}
+
+	close(efd);
+	goto done;
+
+replace:
+	close(efd);
+
+add:
+	/* Only the path is kept, the index never keeps a file alive */
+	unlink(entry);
+	if (g_mkdir_with_parents(dir, 0700) < 0 || symlink(name, entry) < 0)
+		DBG("%s: %s(%d)", entry, strerror(errno), errno);
+
+done:
+	g_free(target);
+	g_free(entry);
+	g_free(dir);
+#endif
+}
+
+/* Called once all the data of a received file has been written, hashed
+ * is the amount of it which went through the checksum */
+void content_index_update(int fd, const char *name, GChecksum *checksum,
+							uint64_t hashed)
+{
+	const char *hash;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return;
+
+	/* Not everything written went through the checksum */
+	if ((uint64_t) st.st_size != hashed)
+		return;
+
+	hash = g_checksum_get_string(checksum);
+
+	content_index_dedupe(fd, name, &st, hash);
+
+	/* Stamped last, with the mtime of the complete file */
+	if (fstat(fd, &st) == 0)
+		content_index_store(fd, &st, hash);
+}
+
+/* Drops the entries of files removed or moved while obexd was not
+ * running, the others are checked when their hash comes up again */
+void content_index_init(void)
+{
+	struct dirent *ep;
+	char *dir;
+	DIR *dp;
+
+	dir = content_index_folder();
+
+	dp = opendir(dir);
+	if (dp == NULL) {
+		g_free(dir);
+		return;
+	}
+
+	while ((ep = readdir(dp))) {
+		struct stat st;
+		char *entry, *target;
+
+		if (ep->d_name[0] == '.')
+			continue;
+
+		entry = g_build_filename(dir, ep->d_name, NULL);
+
+		/* Hardlinks from older versions go as well */
+		target = g_file_read_link(entry, NULL);
+		if (target == NULL || stat(target, &st) < 0 ||
+						!S_ISREG(st.st_mode))
+			unlink(entry);
+
+		g_free(target);
+		g_free(entry);
+	}
+
+	closedir(dp);
+	g_free(dir);
+}
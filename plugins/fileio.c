@@ -0,0 +1,1077 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "obex.h"
+#include "mimetype.h"
+#include "contentindex.h"
+#include "fileio.h"
+
+/* Size of the file window mapped at once when serving GET requests */
+#define FILE_MAP_SIZE (1 << 20)
+
+/* Buffer size for copies the kernel cannot do by itself */
+#define FILE_COPY_SIZE (64 * 1024)
+
+/* Threads doing file reads and writes when async I/O is enabled */
+#define FILE_IO_THREADS 4
+
+/* Received data is written out in aligned blocks of this size */
+#define FILE_WRITE_BLOCK (256 * 1024)
+
+/* Amount of data written between syncs with the periodic policy */
+#define FILE_SYNC_INTERVAL (4 * 1024 * 1024)
+
+enum {
+	FILE_IO_IDLE,
+	FILE_IO_BUSY,
+	FILE_IO_DONE,
+	FILE_IO_FINISH,
+	FILE_IO_COPY,
+};
+
+struct file_object {
+	int fd;
+	gboolean mappable;
+	off_t size;
+	off_t offset;
+	void *map;
+	off_t map_offset;
+	size_t map_size;
+	int refs;
+	gboolean async;
+	gboolean closed;
+	gboolean waiting;
+	int io_state;
+	gboolean io_write;
+	uint8_t *io_buf;
+	size_t io_size;
+	size_t io_len;
+	off_t io_offset;
+	ssize_t io_result;
+	size_t io_consumed;
+	char *name;
+	GChecksum *checksum;
+	uint64_t hashed;
+	uint8_t *wb_buf;
+	size_t wb_len;
+	off_t synced;
+	gboolean io_last;
+	gboolean preallocated;
+	gboolean finished;
+	int copy_fd;
+	void *copy_object;
+};
+
+static GThreadPool *io_pool = NULL;
+G_LOCK_DEFINE_STATIC(file_io);
+
+/* Background copies, only used from the main loop */
+static GSList *copies = NULL;
+
+/* Touching a mapped page past the end of a file raises SIGBUS, so only
+ * files nobody can truncate while they are sent are mapped: those on a
+ * read-only mount, and immutable or append-only ones. Lifting either
+ * takes privileges, other files are read() into the transfer buffer. */
+static gboolean file_mappable(int fd)
+{
+	struct statvfs buf;
+	int attr;
+
+	if (fstatvfs(fd, &buf) == 0 && (buf.f_flag & ST_RDONLY))
+		return TRUE;
+
+	if (ioctl(fd, FS_IOC_GETFLAGS, &attr) < 0)
+		return FALSE;
+
+	return (attr & (FS_IMMUTABLE_FL | FS_APPEND_FL)) != 0;
+}
+
+void *filesystem_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct file_object *object = NULL;
+	struct stat stats;
+	struct statvfs buf;
+	const char *root_folder;
+	char *folder;
+	gboolean root;
+	int fd;
+	uint64_t avail;
+
+	fd = open(name, oflag, mode);
+	if (fd < 0) {
+		if (err)
+			*err = -errno;
+		return NULL;
+	}
+
+	if (fstat(fd, &stats) < 0) {
+		if (err)
+			*err = -errno;
+		goto failed;
+	}
+
+	root_folder = obex_option_root_folder();
+	folder = g_path_get_dirname(name);
+	root = g_strcmp0(folder, root_folder);
+
+	g_free(folder);
+
+	if (!root || obex_option_symlinks()) {
+		if (S_ISLNK(stats.st_mode)) {
+			if (err)
+				*err = -EPERM;
+			goto failed;
+		}
+
+	}
+
+	object = g_new0(struct file_object, 1);
+	object->fd = fd;
+	object->refs = 1;
+	object->async = (io_pool != NULL && S_ISREG(stats.st_mode));
+
+	if (oflag == O_RDONLY) {
+		if (size)
+			*size = stats.st_size;
+		/* Page faults on a mapping would block just like read() */
+		if (S_ISREG(stats.st_mode) && !object->async)
+			object->mappable = file_mappable(fd);
+		object->size = stats.st_size;
+		goto done;
+	}
+
+	if (obex_option_content_index() && (oflag & O_TRUNC) &&
+						S_ISREG(stats.st_mode)) {
+		object->name = g_strdup(name);
+		object->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	}
+
+	if (S_ISREG(stats.st_mode))
+		object->wb_buf = g_malloc(FILE_WRITE_BLOCK);
+
+	if (fstatvfs(fd, &buf) < 0) {
+		if (err)
+			*err = -errno;
+		goto failed;
+	}
+
+	if (size == NULL)
+		goto done;
+
+	avail = (uint64_t) buf.f_bsize * buf.f_bavail;
+	if (avail < *size) {
+		if (err)
+			*err = -ENOSPC;
+		goto failed;
+	}
+
+	if (object->wb_buf == NULL || *size == 0)
+		goto done;
+
+	/* Reserving the whole file up front keeps it contiguous, the size
+	 * is only extended by the data actually written */
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, *size) == 0)
+		object->preallocated = TRUE;
+	else if (errno == ENOSPC) {
+		if (err)
+			*err = -ENOSPC;
+		goto failed;
+	} else
+		DBG("fallocate: %s(%d)", strerror(errno), errno);
+
+done:
+	if (err)
+		*err = 0;
+
+	return object;
+
+failed:
+	if (object && object->checksum) {
+		g_checksum_free(object->checksum);
+		g_free(object->name);
+	}
+
+	if (object)
+		g_free(object->wb_buf);
+
+	g_free(object);
+	close(fd);
+	return NULL;
+}
+
+static void file_unmap(struct file_object *object)
+{
+	if (object->map == NULL)
+		return;
+
+	munmap(object->map, object->map_size);
+	object->map = NULL;
+}
+
+static ssize_t file_write_all(int fd, const uint8_t *buf, size_t len,
+								off_t offset)
+{
+	size_t written = 0;
+	ssize_t ret;
+
+	while (written < len) {
+		ret = pwrite(fd, buf + written, len - written,
+							offset + written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		written += ret;
+	}
+
+	return written;
+}
+
+/* Applies the durability policy once the data up to offset is written */
+static int file_sync(struct file_object *obj, off_t offset, gboolean last)
+{
+	switch (obex_option_durability()) {
+	case OBEX_DURABILITY_PERIODIC:
+		if (!last && offset - obj->synced < FILE_SYNC_INTERVAL)
+			return 0;
+		break;
+	case OBEX_DURABILITY_END:
+		if (!last)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	if (offset == obj->synced)
+		return 0;
+
+	if (fdatasync(obj->fd) < 0)
+		return -errno;
+
+	obj->synced = offset;
+
+	return 0;
+}
+
+/* Called once everything up to end is written */
+static int file_finish(struct file_object *obj, off_t end)
+{
+	obj->finished = TRUE;
+
+	/* Drops what was reserved beyond the data actually received */
+	if (obj->preallocated && ftruncate(obj->fd, end) < 0)
+		return -errno;
+
+	return file_sync(obj, end, TRUE);
+}
+
+/* Writes out what is left of a received file and frees the object. The
+ * data was normally flushed before the PUT got its response, this is
+ * only left to do for transfers that did not complete. */
+static int file_release(struct file_object *obj)
+{
+	int fd = obj->fd, err = 0;
+	ssize_t ret;
+
+	if (obj->wb_len > 0) {
+		ret = file_write_all(fd, obj->wb_buf, obj->wb_len,
+							obj->offset);
+		if (ret < 0)
+			err = ret;
+		else
+			obj->offset += ret;
+	}
+
+	if (obj->wb_buf && !obj->finished) {
+		ret = file_finish(obj, obj->offset);
+		if (err == 0)
+			err = ret;
+	}
+
+	/* A wakeup racing with the close may still be queued for it */
+	obex_object_release(obj);
+
+	if (err < 0)
+		error("%s: %s (%d)", obj->name ? obj->name : "write",
+							strerror(-err), -err);
+
+	file_unmap(obj);
+
+	if (obj->checksum) {
+		if (err == 0)
+			content_index_update(fd, obj->name, obj->checksum,
+								obj->hashed);
+		g_checksum_free(obj->checksum);
+		g_free(obj->name);
+	}
+
+	g_free(obj->wb_buf);
+	g_free(obj->io_buf);
+	g_free(obj);
+
+	if (close(fd) < 0)
+		return -errno;
+
+	return err;
+}
+
+static int file_unref(struct file_object *obj)
+{
+	if (!g_atomic_int_dec_and_test(&obj->refs))
+		return 0;
+
+	/* The last block and sync are left to the writer thread too */
+	if (obj->async && obj->wb_buf && io_pool) {
+		obj->io_state = FILE_IO_FINISH;
+		g_thread_pool_push(io_pool, obj, NULL);
+		return 0;
+	}
+
+	return file_release(obj);
+}
+
+int filesystem_close(void *object)
+{
+	struct file_object *obj = object;
+
+	/* A pending background operation keeps the file open */
+	G_LOCK(file_io);
+	obj->closed = TRUE;
+	G_UNLOCK(file_io);
+
+	return file_unref(obj);
+}
+
+static gboolean file_io_done(void *user_data)
+{
+	struct file_object *obj = user_data;
+	gboolean waiting;
+	int flags;
+
+	G_LOCK(file_io);
+
+	if (obj->closed) {
+		G_UNLOCK(file_io);
+		goto done;
+	}
+
+	if (obj->io_state == FILE_IO_BUSY) {
+		obj->io_state = FILE_IO_DONE;
+		obj->io_consumed = 0;
+	}
+
+	waiting = obj->waiting;
+	obj->waiting = FALSE;
+	flags = obj->io_write ? G_IO_OUT : G_IO_IN;
+
+	G_UNLOCK(file_io);
+
+	/* Delivered once, even if the session has no watch yet */
+	if (waiting)
+		obex_object_wakeup(obj, flags, 0);
+
+done:
+	file_unref(obj);
+
+	return FALSE;
+}
+
+static void file_copy_run(struct file_object *obj);
+
+static void file_io_run(void *data, void *user_data)
+{
+	struct file_object *obj = data;
+	ssize_t ret;
+	int err;
+
+	if (obj->io_state == FILE_IO_FINISH) {
+		file_release(obj);
+		return;
+	}
+
+	if (obj->io_state == FILE_IO_COPY) {
+		file_copy_run(obj);
+		return;
+	}
+
+	if (!obj->io_write) {
+		ret = pread(obj->fd, obj->io_buf, obj->io_len, obj->io_offset);
+		obj->io_result = ret < 0 ? -errno : ret;
+		goto done;
+	}
+
+	ret = file_write_all(obj->fd, obj->io_buf, obj->io_len,
+							obj->io_offset);
+	if (ret >= 0) {
+		if (obj->io_last)
+			err = file_finish(obj, obj->io_offset + ret);
+		else
+			err = file_sync(obj, obj->io_offset + ret, FALSE);
+		if (err < 0)
+			ret = err;
+	}
+
+	obj->io_result = ret;
+
+done:
+	g_idle_add(file_io_done, obj);
+}
+
+/* Called with the file_io lock held */
+static void file_io_submit(struct file_object *obj, size_t count)
+{
+	if (obj->io_size < count) {
+		obj->io_buf = g_realloc(obj->io_buf, count);
+		obj->io_size = count;
+	}
+
+	obj->io_write = FALSE;
+	obj->io_len = count;
+	obj->io_offset = obj->offset;
+	obj->io_state = FILE_IO_BUSY;
+
+	g_atomic_int_inc(&obj->refs);
+	g_thread_pool_push(io_pool, obj, NULL);
+}
+
+/* Called with the file_io lock held. The filled block is handed over
+ * to the writer and the buffer it has just written becomes the next
+ * one to fill. */
+static void file_io_submit_write(struct file_object *obj, gboolean last)
+{
+	uint8_t *buf = obj->io_buf;
+
+	if (obj->io_size < FILE_WRITE_BLOCK)
+		buf = g_realloc(buf, FILE_WRITE_BLOCK);
+
+	obj->io_buf = obj->wb_buf;
+	obj->io_size = FILE_WRITE_BLOCK;
+	obj->wb_buf = buf;
+
+	obj->io_write = TRUE;
+	obj->io_last = last;
+	obj->io_len = obj->wb_len;
+	obj->io_offset = obj->offset;
+	obj->io_state = FILE_IO_BUSY;
+
+	obj->offset += obj->wb_len;
+	obj->wb_len = 0;
+
+	g_atomic_int_inc(&obj->refs);
+	g_thread_pool_push(io_pool, obj, NULL);
+}
+
+static ssize_t file_async_read(struct file_object *obj, void *buf,
+								size_t count)
+{
+	ssize_t ret;
+
+	G_LOCK(file_io);
+
+	switch (obj->io_state) {
+	case FILE_IO_IDLE:
+		file_io_submit(obj, count);
+		/* fall through */
+	case FILE_IO_BUSY:
+		obj->waiting = TRUE;
+		ret = -EAGAIN;
+		break;
+	default:
+		ret = obj->io_result;
+		if (ret < 0) {
+			obj->io_state = FILE_IO_IDLE;
+			break;
+		}
+
+		ret = MIN(count, obj->io_result - obj->io_consumed);
+		memcpy(buf, obj->io_buf + obj->io_consumed, ret);
+		obj->io_consumed += ret;
+		obj->offset += ret;
+
+		if (obj->io_consumed < (size_t) obj->io_result)
+			break;
+
+		obj->io_state = FILE_IO_IDLE;
+
+		/* Read ahead the next chunk unless end of file was reached */
+		if (ret > 0)
+			file_io_submit(obj, count);
+		break;
+	}
+
+	G_UNLOCK(file_io);
+
+	return ret;
+}
+
+static int file_write_block(struct file_object *obj)
+{
+	ssize_t ret;
+
+	ret = file_write_all(obj->fd, obj->wb_buf, obj->wb_len, obj->offset);
+	if (ret < 0)
+		return ret;
+
+	obj->offset += ret;
+	obj->wb_len = 0;
+
+	return 0;
+}
+
+/* Writes out a filled block, in the background with async I/O */
+static int file_flush(struct file_object *obj)
+{
+	ssize_t ret;
+
+	if (!obj->async) {
+		ret = file_write_block(obj);
+		if (ret < 0)
+			return ret;
+
+		return file_sync(obj, obj->offset, FALSE);
+	}
+
+	G_LOCK(file_io);
+
+	switch (obj->io_state) {
+	case FILE_IO_BUSY:
+		obj->waiting = TRUE;
+		ret = -EAGAIN;
+		break;
+	case FILE_IO_DONE:
+		obj->io_state = FILE_IO_IDLE;
+		if (obj->io_result < 0) {
+			ret = obj->io_result;
+			break;
+		}
+		/* fall through */
+	default:
+		file_io_submit_write(obj, FALSE);
+		ret = 0;
+		break;
+	}
+
+	G_UNLOCK(file_io);
+
+	return ret;
+}
+
+/* Writes out the last block and applies the durability policy before
+ * the PUT is answered. With async I/O the transfer waits for the writer
+ * and gets the result of the last block. */
+int filesystem_flush(void *object)
+{
+	struct file_object *obj = object;
+	int ret;
+
+	if (obj->wb_buf == NULL)
+		return 0;
+
+	if (!obj->async) {
+		ret = file_write_block(obj);
+		if (ret < 0)
+			return ret;
+
+		return file_finish(obj, obj->offset);
+	}
+
+	G_LOCK(file_io);
+
+	switch (obj->io_state) {
+	case FILE_IO_BUSY:
+		obj->waiting = TRUE;
+		ret = -EAGAIN;
+		break;
+	case FILE_IO_DONE:
+		obj->io_state = FILE_IO_IDLE;
+		if (obj->io_result < 0 || obj->io_last) {
+			ret = MIN(obj->io_result, 0);
+			break;
+		}
+		/* fall through */
+	default:
+		if (obj->io_last) {
+			ret = 0;
+			break;
+		}
+
+		file_io_submit_write(obj, TRUE);
+		obj->waiting = TRUE;
+		ret = -EAGAIN;
+		break;
+	}
+
+	G_UNLOCK(file_io);
+
+	return ret;
+}
+
+ssize_t filesystem_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
+{
+	struct file_object *obj = object;
+	ssize_t ret;
+
+	if (obj->async) {
+		ret = file_async_read(obj, buf, count);
+		if (ret < 0)
+			return ret;
+
+		goto done;
+	}
+
+	ret = read(obj->fd, buf, count);
+	if (ret < 0)
+		return -errno;
+
+done:
+	if (flags)
+		*flags = 0;
+
+	*hi = OBEX_HDR_BODY;
+
+	return ret;
+}
+
+static int file_remap(struct file_object *obj)
+{
+	struct stat stats;
+	void *map;
+
+	file_unmap(obj);
+
+	/* Never map past the current end, it only grows when appended to */
+	if (fstat(obj->fd, &stats) < 0)
+		return -errno;
+
+	if (stats.st_size < obj->size)
+		obj->size = stats.st_size;
+
+	if (obj->offset >= obj->size)
+		return 0;
+
+	obj->map_offset = obj->offset & ~((off_t) FILE_MAP_SIZE - 1);
+	obj->map_size = MIN(FILE_MAP_SIZE, obj->size - obj->map_offset);
+
+	map = mmap(NULL, obj->map_size, PROT_READ, MAP_SHARED, obj->fd,
+							obj->map_offset);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	madvise(map, obj->map_size, MADV_SEQUENTIAL);
+	obj->map = map;
+
+	return 0;
+}
+
+ssize_t filesystem_map(void *object, const void **buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
+{
+	struct file_object *obj = object;
+	off_t start;
+	size_t len;
+	int err;
+
+	if (!obj->mappable)
+		return -ENOSYS;
+
+	if (obj->map == NULL ||
+			obj->offset >= obj->map_offset + (off_t) obj->map_size) {
+		err = file_remap(obj);
+		if (err < 0) {
+			DBG("mmap: %s (%d)", strerror(-err), -err);
+
+			/* Continue with read() from where mapping stopped */
+			obj->mappable = FALSE;
+			if (lseek(obj->fd, obj->offset, SEEK_SET) < 0)
+				return -errno;
+
+			return -ENOSYS;
+		}
+	}
+
+	if (flags)
+		*flags = 0;
+
+	*hi = OBEX_HDR_BODY;
+
+	if (obj->map == NULL)
+		return 0;
+
+	start = obj->offset - obj->map_offset;
+	len = MIN(count, obj->map_size - start);
+
+	*buf = (const uint8_t *) obj->map + start;
+	obj->offset += len;
+
+	return len;
+}
+
+ssize_t filesystem_write(void *object, const void *buf, size_t count)
+{
+	struct file_object *obj = object;
+	ssize_t ret;
+	int err;
+
+	if (obj->wb_buf == NULL) {
+		ret = write(obj->fd, buf, count);
+		if (ret < 0)
+			return -errno;
+
+		goto done;
+	}
+
+	ret = MIN(count, FILE_WRITE_BLOCK - obj->wb_len);
+	memcpy(obj->wb_buf + obj->wb_len, buf, ret);
+	obj->wb_len += ret;
+
+	/* Blocks are written out as soon as they are full, whether or not
+	 * the length of the file is known. The data is taken again when
+	 * the writer is still busy with the previous one. */
+	if (obj->wb_len == FILE_WRITE_BLOCK) {
+		err = file_flush(obj);
+		if (err == -EAGAIN)
+			obj->wb_len -= ret;
+		if (err < 0)
+			return err;
+	}
+
+done:
+	if (ret > 0 && obj->checksum) {
+		g_checksum_update(obj->checksum, buf, ret);
+		obj->hashed += ret;
+	}
+
+	return ret;
+}
+
+/* Copies the next chunk and returns its size, 0 at the end. It stays
+ * inside the kernel with copy_file_range() as long as that works for
+ * these files, buf is only used for copies through user space. */
+static ssize_t file_copy_chunk(int src, int dst, uint8_t **buf,
+							gboolean *kernel)
+{
+	ssize_t ret, len, written;
+
+#ifdef __NR_copy_file_range
+	if (*kernel) {
+		ret = syscall(__NR_copy_file_range, src, NULL, dst, NULL,
+							FILE_MAP_SIZE, 0);
+		if (ret >= 0)
+			return ret;
+
+		switch (errno) {
+		case ENOSYS:
+		case EXDEV:
+		case EINVAL:
+		case EOPNOTSUPP:
+			*kernel = FALSE;
+			break;
+		default:
+			return -errno;
+		}
+	}
+#endif
+
+	if (*buf == NULL)
+		*buf = g_malloc(FILE_COPY_SIZE);
+
+	len = read(src, *buf, FILE_COPY_SIZE);
+	if (len < 0)
+		return -errno;
+
+	for (written = 0; written < len; written += ret) {
+		ret = write(dst, *buf + written, len - written);
+		if (ret < 0)
+			return -errno;
+	}
+
+	return len;
+}
+
+static int file_copy_data(int src, int dst)
+{
+	gboolean kernel = TRUE;
+	uint8_t *buf = NULL;
+	ssize_t ret;
+
+	while ((ret = file_copy_chunk(src, dst, &buf, &kernel)) > 0)
+		;
+
+	g_free(buf);
+
+	return ret;
+}
+
+static gboolean file_copy_done(void *user_data)
+{
+	struct file_object *obj = user_data;
+	int err = obj->io_result;
+
+	if (close(obj->fd) < 0 && err == 0)
+		err = -errno;
+
+	close(obj->copy_fd);
+
+	if (err < 0)
+		unlink(obj->name);
+
+	copies = g_slist_remove(copies, obj);
+
+	/* NULL once the request was cancelled */
+	if (obj->copy_object)
+		obex_object_wakeup(obj->copy_object, G_IO_OUT, err);
+
+	g_free(obj->io_buf);
+	g_free(obj->name);
+	g_free(obj);
+
+	return FALSE;
+}
+
+/* Runs in an I/O thread, a chunk at a time so that no call blocks for
+ * long while the main loop stays free for the other transfers */
+static void file_copy_run(struct file_object *obj)
+{
+	gboolean kernel = TRUE;
+	ssize_t ret;
+
+	while ((ret = file_copy_chunk(obj->copy_fd, obj->fd, &obj->io_buf,
+							&kernel)) > 0) {
+		if (g_atomic_int_get(&obj->closed)) {
+			ret = -ECANCELED;
+			break;
+		}
+	}
+
+	obj->io_result = ret;
+
+	g_idle_add(file_copy_done, obj);
+}
+
+/* Queued to the I/O threads, the result goes to the io watch of object */
+static void file_copy_submit(int src, int dst, const char *destname,
+								void *object)
+{
+	struct file_object *obj;
+
+	obj = g_new0(struct file_object, 1);
+	obj->fd = dst;
+	obj->copy_fd = src;
+	obj->copy_object = object;
+	obj->name = g_strdup(destname);
+	obj->io_state = FILE_IO_COPY;
+
+	copies = g_slist_prepend(copies, obj);
+
+	g_thread_pool_push(io_pool, obj, NULL);
+}
+
+/* The copy stops at the next chunk and its partial target is removed */
+void filesystem_cancel(void *object)
+{
+	GSList *l;
+
+	for (l = copies; l; l = l->next) {
+		struct file_object *obj = l->data;
+
+		if (obj->copy_object != object)
+			continue;
+
+		obj->copy_object = NULL;
+		g_atomic_int_set(&obj->closed, TRUE);
+	}
+}
+
+/* Copies stay inside the kernel when possible: a reflink shares the
+ * blocks on filesystems supporting it, copy_file_range() avoids the
+ * round trip through user space otherwise. Anything but a reflink is
+ * done in the background with async I/O. */
+int filesystem_copy(const char *name, const char *destname,
+								void *object)
+{
+	struct stat st;
+	int src, dst, err;
+
+	src = open(name, O_RDONLY);
+	if (src < 0)
+		return -errno;
+
+	if (fstat(src, &st) < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	/* Only regular files can be copied */
+	if (!S_ISREG(st.st_mode)) {
+		err = -EINVAL;
+		goto done;
+	}
+
+	dst = open(destname, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777);
+	if (dst < 0) {
+		err = -errno;
+		goto done;
+	}
+
+#ifdef FICLONE
+	if (ioctl(dst, FICLONE, src) == 0) {
+		err = 0;
+		goto closed;
+	}
+#endif
+
+	if (io_pool && object) {
+		file_copy_submit(src, dst, destname, object);
+		return -EAGAIN;
+	}
+
+	err = file_copy_data(src, dst);
+
+closed:
+	if (close(dst) < 0 && err == 0)
+		err = -errno;
+
+	if (err < 0)
+		unlink(destname);
+
+done:
+	close(src);
+
+	return err;
+}
+
+/* Like rename(), but fails with EEXIST when destname is taken */
+static int file_rename_noreplace(const char *name, const char *destname)
+{
+	struct stat st;
+	int err;
+
+#if defined(__NR_renameat2) && defined(RENAME_NOREPLACE)
+	if (syscall(__NR_renameat2, AT_FDCWD, name, AT_FDCWD, destname,
+						RENAME_NOREPLACE) == 0)
+		return 0;
+
+	if (errno != ENOSYS && errno != EINVAL)
+		return -errno;
+#endif
+
+	if (lstat(name, &st) < 0)
+		return -errno;
+
+	/* Directories cannot be linked, only these can still race */
+	if (S_ISDIR(st.st_mode)) {
+		if (lstat(destname, &st) == 0)
+			return -EEXIST;
+
+		if (rename(name, destname) < 0)
+			return -errno;
+
+		return 0;
+	}
+
+	if (link(name, destname) < 0)
+		return -errno;
+
+	if (unlink(name) < 0) {
+		err = -errno;
+		unlink(destname);
+		return err;
+	}
+
+	return 0;
+}
+
+/* Moving must not replace an existing object */
+int filesystem_rename(const char *name, const char *destname)
+{
+	int err;
+
+	err = file_rename_noreplace(name, destname);
+	if (err != -EXDEV)
+		return err;
+
+	/* Across filesystems the data is copied on the calling thread, the
+	 * source is only removed once the copy succeeded */
+	err = filesystem_copy(name, destname, NULL);
+	if (err < 0)
+		return err;
+
+	if (unlink(name) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int file_io_init(void)
+{
+	if (!obex_option_async_io())
+		return 0;
+
+	io_pool = g_thread_pool_new(file_io_run, NULL, FILE_IO_THREADS,
+								FALSE, NULL);
+	if (io_pool == NULL)
+		error("Unable to create file I/O threads");
+
+	return 0;
+}
+
+void file_io_exit(void)
+{
+	if (io_pool) {
+		g_thread_pool_free(io_pool, FALSE, TRUE);
+		io_pool = NULL;
+	}
+}
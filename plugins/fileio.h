@@ -0,0 +1,40 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Regular files, read and written in background threads with async I/O */
+int file_io_init(void);
+void file_io_exit(void);
+
+void *filesystem_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err);
+int filesystem_close(void *object);
+ssize_t filesystem_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags);
+ssize_t filesystem_map(void *object, const void **buf, size_t count,
+					uint8_t *hi, unsigned int *flags);
+ssize_t filesystem_write(void *object, const void *buf, size_t count);
+int filesystem_flush(void *object);
+int filesystem_copy(const char *name, const char *destname, void *object);
+void filesystem_cancel(void *object);
+int filesystem_rename(const char *name, const char *destname);
@@ -26,6 +26,8 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -35,9 +37,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/statvfs.h>
 #include <fcntl.h>
-#include <wait.h>
 
 #include <glib.h>
 
@@ -50,6 +50,12 @@
 #include "mimetype.h"
 #include "service.h"
 #include "filesystem.h"
+#include "listingcache.h"
+#include "journal.h"
+#include "contentindex.h"
+#include "capability.h"
+#include "archive.h"
+#include "fileio.h"
 
 #define EOL_CHARS "\n"
 
@@ -68,7 +74,9 @@
 
 #define FL_FILE_ELEMENT "<file name=\"%s\" size=\"%" PRIu64 "\"" \
 			" %s accessed=\"%s\" " \
-			"modified=\"%s\" created=\"%s\"/>" EOL_CHARS
+			"modified=\"%s\" created=\"%s\"%s/>" EOL_CHARS
+
+#define FL_HASH_ATTRIBUTE " sha256=\"%s\""
 
 #define FL_FOLDER_ELEMENT "<folder name=\"%s\" %s accessed=\"%s\" " \
 			"modified=\"%s\" created=\"%s\"/>" EOL_CHARS
@@ -83,16 +91,19 @@ static const uint8_t FTP_TARGET[TARGET_SIZE] = {
 
 #define PCSUITE_WHO_SIZE 8
 
+/* Consumed data is dropped from string buffers in steps of this size */
+#define STRING_BUFFER_CHUNK (64 * 1024)
+
 static const uint8_t PCSUITE_WHO[PCSUITE_WHO_SIZE] = {
 			'P','C',' ','S','u','i','t','e' };
 
 
-static char *file_stat_line(char *filename, struct stat *fstat,
+static char *file_stat_line(const char *filename, struct stat *fstat,
 					struct stat *dstat, gboolean root,
-					gboolean pcsuite)
+					gboolean pcsuite, const char *hash)
 {
 	char perm[51], atime[18], ctime[18], mtime[18];
-	char *escaped, *ret = NULL;
+	char *escaped, *extra = NULL, *ret = NULL;
 
 	snprintf(perm, 50, "user-perm=\"%s%s%s\" group-perm=\"%s%s%s\" "
 			"other-perm=\"%s%s%s\"",
@@ -120,451 +131,362 @@ static char *file_stat_line(char *filename, struct stat *fstat,
 		else
 			ret = g_strdup_printf(FL_FOLDER_ELEMENT, escaped, perm,
 							atime, mtime, ctime);
-	} else if (S_ISREG(fstat->st_mode))
+	} else if (S_ISREG(fstat->st_mode)) {
+		if (hash)
+			extra = g_strdup_printf(FL_HASH_ATTRIBUTE, hash);
+
 		ret = g_strdup_printf(FL_FILE_ELEMENT, escaped,
 					(uint64_t) fstat->st_size,
-					perm, atime, mtime, ctime);
+					perm, atime, mtime, ctime,
+					extra ? extra : "");
+	}
 
+	g_free(extra);
 	g_free(escaped);
 
 	return ret;
 }
 
-static void *filesystem_open(const char *name, int oflag, mode_t mode,
-					void *context, size_t *size, int *err)
-{
-	struct stat stats;
-	struct statvfs buf;
-	const char *root_folder;
-	char *folder;
-	gboolean root;
-	int fd = open(name, oflag, mode);
-	uint64_t avail;
-
-	if (fd < 0) {
-		if (err)
-			*err = -errno;
-		return NULL;
-	}
-
-	if (fstat(fd, &stats) < 0) {
-		if (err)
-			*err = -errno;
-		goto failed;
-	}
-
-	root_folder = obex_option_root_folder();
-	folder = g_path_get_dirname(name);
-	root = g_strcmp0(folder, root_folder);
-
-	g_free(folder);
-
-	if (!root || obex_option_symlinks()) {
-		if (S_ISLNK(stats.st_mode)) {
-			if (err)
-				*err = -EPERM;
-			goto failed;
-		}
+struct string_buffer {
+	GString *data;
+	size_t offset;
+};
 
-	}
+/* Folder listings are generated while they are read, only the entries
+ * needed to fill the next packet are kept in memory. What has been
+ * generated is also recorded for the cache unless the folder changes
+ * in the meantime. */
+struct folder_listing {
+	DIR *dp;
+	char *name;
+	struct stat dstat;
+	gboolean root;
+	gboolean symlinks;
+	gboolean pcsuite;
+	gboolean utf8;
+	struct string_buffer *buffer;
+	struct listing_dir *dir;
+	unsigned int changes;
+	GString *record;
+	struct listing_entry *cached;
+	size_t offset;
+};
 
-	if (oflag == O_RDONLY) {
-		if (size)
-			*size = stats.st_size;
-		goto done;
-	}
+static void folder_listing_append(struct folder_listing *fl, const char *str)
+{
+	size_t len = strlen(str);
 
-	if (fstatvfs(fd, &buf) < 0) {
-		if (err)
-			*err = -errno;
-		goto failed;
-	}
+	string_buffer_append(fl->buffer, str, len);
 
-	if (size == NULL)
-		goto done;
+	if (fl->record == NULL)
+		return;
 
-	avail = (uint64_t) buf.f_bsize * buf.f_bavail;
-	if (avail < *size) {
-		if (err)
-			*err = -ENOSPC;
-		goto failed;
+	/* Too large to be worth keeping around */
+	if (fl->record->len + len > LISTING_CACHE_MAX_LEN) {
+		g_string_free(fl->record, TRUE);
+		fl->record = NULL;
+		return;
 	}
 
-done:
-	if (err)
-		*err = 0;
-
-	return GINT_TO_POINTER(fd);
-
-failed:
-	close(fd);
-	return NULL;
+	g_string_append_len(fl->record, str, len);
 }
 
-static int filesystem_close(void *object)
+static void folder_listing_free(struct folder_listing *fl)
 {
-	if (close(GPOINTER_TO_INT(object)) < 0)
-		return -errno;
+	if (fl->dp)
+		closedir(fl->dp);
 
-	return 0;
-}
-
-static ssize_t filesystem_read(void *object, void *buf, size_t count,
-					uint8_t *hi, unsigned int *flags)
-{
-	ssize_t ret;
+	if (fl->dir)
+		listing_dir_release(fl->dir);
 
-	ret = read(GPOINTER_TO_INT(object), buf, count);
-	if (ret < 0)
-		return -errno;
+	if (fl->record)
+		g_string_free(fl->record, TRUE);
 
-	if (flags)
-		*flags = 0;
+	if (fl->cached)
+		listing_entry_unref(fl->cached);
 
-	*hi = OBEX_HDR_BODY;
+	if (fl->buffer)
+		string_buffer_free(fl->buffer);
 
-	return ret;
+	g_free(fl->name);
+	g_free(fl);
 }
 
-static ssize_t filesystem_write(void *object, const void *buf, size_t count)
+static void *folder_listing_open(const char *name, gboolean pcsuite,
+						size_t *size, int *err)
 {
-	ssize_t ret;
-
-	ret = write(GPOINTER_TO_INT(object), buf, count);
-	if (ret < 0)
-		return -errno;
-
-	return ret;
-}
-
-struct capability_object {
-	int pid;
-	int output;
-	int err;
-	gboolean aborted;
-	GString *buffer;
-};
-
-static void script_exited(GPid pid, int status, void *data)
-{
-	struct capability_object *object = data;
-	char buf[128];
-
-	object->pid = -1;
-
-	DBG("pid: %d status: %d", pid, status);
+	struct folder_listing *fl;
+	int ret;
 
-	g_spawn_close_pid(pid);
+	fl = g_new0(struct folder_listing, 1);
+	fl->name = g_strdup(name);
+	fl->root = g_str_equal(name, obex_option_root_folder());
+	fl->symlinks = obex_option_symlinks();
+	fl->pcsuite = pcsuite;
 
-	/* free the object if aborted */
-	if (object->aborted) {
-		if (object->buffer != NULL)
-			g_string_free(object->buffer, TRUE);
+	if (fl->root && fl->symlinks)
+		ret = stat(name, &fl->dstat);
+	else
+		ret = lstat(name, &fl->dstat);
 
-		g_free(object);
-		return;
+	if (ret < 0) {
+		if (err)
+			*err = -errno;
+		goto failed;
 	}
 
-	if (WEXITSTATUS(status) != EXIT_SUCCESS) {
-		memset(buf, 0, sizeof(buf));
-		if (read(object->err, buf, sizeof(buf)) > 0)
-			error("%s", buf);
-		obex_object_set_io_flags(data, G_IO_ERR, -EPERM);
-	} else
-		obex_object_set_io_flags(data, G_IO_IN, 0);
-}
+	fl->cached = listing_cache_lookup(&fl->dstat, fl->root, fl->symlinks,
+								pcsuite);
+	if (fl->cached) {
+		if (size)
+			*size = fl->cached->len;
+		goto done;
+	}
 
-static int capability_exec(const char **argv, int *output, int *err)
-{
-	GError *gerr = NULL;
-	int pid;
-	GSpawnFlags flags = G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH;
-
-	if (!g_spawn_async_with_pipes(NULL, (char **) argv, NULL, flags, NULL,
-				NULL, &pid, NULL, output, err, &gerr)) {
-		error("%s", gerr->message);
-		g_error_free(gerr);
-		return -EPERM;
+	fl->dp = opendir(name);
+	if (fl->dp == NULL) {
+		if (err)
+			*err = -ENOENT;
+		goto failed;
 	}
 
-	DBG("executing %s pid %d", argv[0], pid);
+	fl->buffer = string_buffer_new(NULL);
 
-	return pid;
-}
+	/* Names need no conversion when the filesystem encoding is UTF-8 */
+	fl->utf8 = g_get_filename_charsets(NULL);
 
-static void *capability_open(const char *name, int oflag, mode_t mode,
-					void *context, size_t *size, int *err)
-{
-	struct capability_object *object = NULL;
-	char *buf;
-	const char *argv[2];
-
-	if (oflag != O_RDONLY)
-		goto fail;
-
-	object = g_new0(struct capability_object, 1);
-	object->pid = -1;
-	object->output = -1;
-	object->err = -1;
-
-	if (name[0] != '!') {
-		GError *gerr = NULL;
-		gboolean ret;
-
-		ret = g_file_get_contents(name, &buf, NULL, &gerr);
-		if (ret == FALSE) {
-			error("%s", gerr->message);
-			g_error_free(gerr);
-			goto fail;
-		}
+	/* Watch before reading so that no change can be missed */
+	fl->dir = listing_dir_watch(name, &fl->changes);
 
-		object->buffer = g_string_new(buf);
+	if (fl->dir)
+		fl->record = g_string_new(NULL);
 
-		if (size)
-			*size = object->buffer->len;
+	folder_listing_append(fl, FL_VERSION);
 
-		goto done;
-	}
+	if (pcsuite)
+		folder_listing_append(fl, FL_TYPE_PCSUITE);
+	else
+		folder_listing_append(fl, FL_TYPE);
 
-	argv[0] = &name[1];
-	argv[1] = NULL;
+	folder_listing_append(fl, FL_BODY_BEGIN);
 
-	object->pid = capability_exec(argv, &object->output, &object->err);
-	if (object->pid < 0)
-		goto fail;
-
-	/* Watch cannot be removed while the process is still running */
-	g_child_watch_add(object->pid, script_exited, object);
+	if (!fl->root || !fl->symlinks)
+		folder_listing_append(fl, FL_PARENT_FOLDER_ELEMENT);
 
 done:
 	if (err)
 		*err = 0;
 
-	return object;
-
-fail:
-	if (err)
-		*err = -EPERM;
+	return fl;
 
-	g_free(object);
+failed:
+	folder_listing_free(fl);
 	return NULL;
 }
 
-static GString *append_pcsuite_preamble(GString *object)
+/* Appends the next entry, or the closing tag once the folder is done.
+ * Entries are stat'ed relative to the directory descriptor, so neither
+ * a full path is built nor walked again by the kernel for each one. */
+static gboolean folder_listing_next(struct folder_listing *fl)
 {
-	return g_string_append(object, FL_TYPE_PCSUITE);
-}
-
-static GString *append_folder_preamble(GString *object)
-{
-	return g_string_append(object, FL_TYPE);
-}
-
-static GString *append_listing(GString *object, const char *name,
-				gboolean pcsuite, size_t *size, int *err)
-{
-	struct stat fstat, dstat;
+	struct stat fstat;
 	struct dirent *ep;
-	DIR *dp;
-	gboolean root, symlinks;
-	int ret;
+	int dfd, flags;
 
-	root = g_str_equal(name, obex_option_root_folder());
+	if (fl->dp == NULL)
+		return FALSE;
 
-	dp = opendir(name);
-	if (dp == NULL) {
-		if (err)
-			*err = -ENOENT;
-		goto failed;
-	}
+	dfd = dirfd(fl->dp);
+	flags = fl->root && fl->symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
 
-	symlinks = obex_option_symlinks();
-	if (root && symlinks)
-		ret = stat(name, &dstat);
-	else {
-		object = g_string_append(object, FL_PARENT_FOLDER_ELEMENT);
-		ret = lstat(name, &dstat);
-	}
-
-	if (ret < 0) {
-		if (err)
-			*err = -errno;
-		goto failed;
-	}
-
-	while ((ep = readdir(dp))) {
-		char *filename;
-		char *fullname;
+	while ((ep = readdir(fl->dp))) {
+		char *converted = NULL;
+		const char *filename;
+		gboolean hashed = FALSE;
+		char hash[65];
 		char *line;
 
 		if (ep->d_name[0] == '.')
 			continue;
 
-		filename = g_filename_to_utf8(ep->d_name, -1, NULL, NULL, NULL);
-		if (name == NULL) {
-			error("g_filename_to_utf8: invalid filename");
+		if (fstatat(dfd, ep->d_name, &fstat, flags) < 0) {
+			DBG("%s: %s(%d)", flags ? "lstat" : "stat",
+					strerror(errno), errno);
 			continue;
 		}
 
-		fullname = g_build_filename(name, ep->d_name, NULL);
-
-		if (root && symlinks)
-			ret = stat(fullname, &fstat);
-		else
-			ret = lstat(fullname, &fstat);
-
-		if (ret < 0) {
-			DBG("%s: %s(%d)", root ? "stat" : "lstat",
-					strerror(errno), errno);
-			g_free(filename);
-			g_free(fullname);
-			continue;
+		if (fl->utf8 && g_utf8_validate(ep->d_name, -1, NULL))
+			filename = ep->d_name;
+		else {
+			converted = g_filename_to_utf8(ep->d_name, -1, NULL,
+								NULL, NULL);
+			if (converted == NULL) {
+				error("g_filename_to_utf8: invalid filename");
+				continue;
+			}
+
+			filename = converted;
 		}
 
-		g_free(fullname);
+		if (obex_option_content_index() && S_ISREG(fstat.st_mode))
+			hashed = content_index_attr(dfd, ep->d_name, flags,
+					&fstat, hash, sizeof(hash)) == 0;
 
-		line = file_stat_line(filename, &fstat, &dstat, root, FALSE);
-		if (line == NULL) {
-			g_free(filename);
-			continue;
-		}
+		line = file_stat_line(filename, &fstat, &fl->dstat, fl->root,
+						FALSE, hashed ? hash : NULL);
+		g_free(converted);
 
-		g_free(filename);
+		if (line == NULL)
+			continue;
 
-		object = g_string_append(object, line);
+		folder_listing_append(fl, line);
 		g_free(line);
-	}
 
-	closedir(dp);
-
-	object = g_string_append(object, FL_BODY_END);
-	if (size)
-		*size = object->len;
+		return TRUE;
+	}
 
-	if (err)
-		*err = 0;
+	closedir(fl->dp);
+	fl->dp = NULL;
 
-	return object;
+	folder_listing_append(fl, FL_BODY_END);
 
-failed:
-	if (dp)
-		closedir(dp);
+	/* The cache takes over the watch and what was recorded */
+	if (fl->record) {
+		listing_cache_store(fl->dir, fl->changes, &fl->dstat,
+					fl->root, fl->symlinks, fl->pcsuite,
+					fl->record);
+		fl->dir = NULL;
+		fl->record = NULL;
+	}
 
-	g_string_free(object, TRUE);
-	return NULL;
+	return TRUE;
 }
 
 static void *folder_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
-	GString *object;
-
-	object = g_string_new(FL_VERSION);
-	object = append_folder_preamble(object);
-	object = g_string_append(object, FL_BODY_BEGIN);
-
-	return append_listing(object, name, FALSE, size, err);
+	/* The size is only known when the listing is cached */
+	return folder_listing_open(name, FALSE, size, err);
 }
 
 static void *pcsuite_open(const char *name, int oflag, mode_t mode,
 					void *context, size_t *size, int *err)
 {
-	GString *object;
+	return folder_listing_open(name, TRUE, size, err);
+}
 
-	object = g_string_new(FL_VERSION);
-	object = append_pcsuite_preamble(object);
-	object = g_string_append(object, FL_BODY_BEGIN);
+static int folder_close(void *object)
+{
+	folder_listing_free(object);
 
-	return append_listing(object, name, TRUE, size, err);
+	return 0;
 }
 
-static int string_free(void *object)
+struct string_buffer *string_buffer_new(const char *init)
 {
-	GString *string = object;
+	struct string_buffer *sb;
 
-	g_string_free(string, TRUE);
+	sb = g_new0(struct string_buffer, 1);
+	sb->data = g_string_new(init);
 
-	return 0;
+	return sb;
 }
 
-ssize_t string_read(void *object, void *buf, size_t count)
+void string_buffer_free(struct string_buffer *sb)
 {
-	GString *string = object;
-	ssize_t len;
+	g_string_free(sb->data, TRUE);
+	g_free(sb);
+}
 
-	if (string->len == 0)
-		return 0;
+void string_buffer_append(struct string_buffer *sb, const char *data,
+								gssize len)
+{
+	g_string_append_len(sb->data, data, len);
+}
 
-	len = MIN(string->len, count);
-	memcpy(buf, string->str, len);
-	string = g_string_erase(string, 0, len);
+void string_buffer_append_printf(struct string_buffer *sb,
+					const char *format, ...)
+{
+	va_list ap;
+	char *str;
 
-	return len;
+	va_start(ap, format);
+	str = g_strdup_vprintf(format, ap);
+	va_end(ap);
+
+	g_string_append(sb->data, str);
+	g_free(str);
 }
 
-static ssize_t folder_read(void *object, void *buf, size_t count,
-					uint8_t *hi, unsigned int *flags)
+size_t string_buffer_len(struct string_buffer *sb)
 {
-	if (flags)
-		*flags = 0;
-
-	*hi = OBEX_HDR_BODY;
-	return string_read(object, buf, count);
+	return sb->data->len - sb->offset;
 }
 
-static ssize_t capability_read(void *object, void *buf, size_t count,
-					uint8_t *hi, unsigned int *flags)
+/* Reads advance an offset instead of moving the rest of the data. Once
+ * a chunk worth of data has been consumed and it is at least half of
+ * the buffer, the remainder is copied into a new string so the memory
+ * is released while streaming and the copies stay linear overall. */
+ssize_t string_buffer_read(struct string_buffer *sb, void *buf, size_t count)
 {
-	struct capability_object *obj = object;
+	GString *data;
+	size_t len;
 
-	if (flags)
-		*flags = 0;
+	len = MIN(string_buffer_len(sb), count);
+	if (len == 0)
+		return 0;
 
-	*hi = OBEX_HDR_BODY;
+	memcpy(buf, sb->data->str + sb->offset, len);
+	sb->offset += len;
 
-	if (obj->buffer)
-		return string_read(obj->buffer, buf, count);
+	if (sb->offset < STRING_BUFFER_CHUNK || sb->offset < sb->data->len / 2)
+		return len;
 
-	if (obj->pid >= 0)
-		return -EAGAIN;
+	data = g_string_new_len(sb->data->str + sb->offset,
+					sb->data->len - sb->offset);
+	g_string_free(sb->data, TRUE);
+	sb->data = data;
+	sb->offset = 0;
 
-	return read(obj->output, buf, count);
+	return len;
 }
 
-static int capability_close(void *object)
+static ssize_t folder_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
 {
-	struct capability_object *obj = object;
-	int err = 0;
+	struct folder_listing *fl = object;
+	size_t len;
 
-	if (obj->pid < 0)
-		goto done;
-
-	DBG("kill: pid %d", obj->pid);
-	err = kill(obj->pid, SIGTERM);
-	if (err < 0) {
-		err = -errno;
-		error("kill: %s (%d)", strerror(-err), -err);
-		goto done;
-	}
+	if (flags)
+		*flags = 0;
 
-	obj->aborted = TRUE;
-	return 0;
+	*hi = OBEX_HDR_BODY;
 
-done:
-	if (obj->buffer != NULL)
-		g_string_free(obj->buffer, TRUE);
+	if (fl->cached) {
+		len = MIN(count, fl->cached->len - fl->offset);
+		memcpy(buf, fl->cached->data + fl->offset, len);
+		fl->offset += len;
+		return len;
+	}
 
-	g_free(obj);
+	while (string_buffer_len(fl->buffer) < count &&
+					folder_listing_next(fl))
+		;
 
-	return err;
+	return string_buffer_read(fl->buffer, buf, count);
 }
 
 static struct obex_mime_type_driver file = {
 	.open = filesystem_open,
 	.close = filesystem_close,
 	.read = filesystem_read,
+	.map = filesystem_map,
 	.write = filesystem_write,
+	.flush = filesystem_flush,
 	.remove = remove,
+	.copy = filesystem_copy,
+	.cancel = filesystem_cancel,
+	.rename = filesystem_rename,
 };
 
 static struct obex_mime_type_driver capability = {
@@ -581,10 +503,28 @@ static struct obex_mime_type_driver folder = {
 	.target_size = TARGET_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = folder_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
+static struct obex_mime_type_driver archive = {
+	.target = FTP_TARGET,
+	.target_size = TARGET_SIZE,
+	.mimetype = "application/x-tar",
+	.open = archive_open,
+	.close = archive_close,
+	.read = archive_read,
+};
+
+static struct obex_mime_type_driver changes = {
+	.target = FTP_TARGET,
+	.target_size = TARGET_SIZE,
+	.mimetype = "x-obex/change-listing",
+	.open = changes_open,
+	.close = changes_close,
+	.read = changes_read,
+};
+
 static struct obex_mime_type_driver pcsuite = {
 	.target = FTP_TARGET,
 	.target_size = TARGET_SIZE,
@@ -592,7 +532,7 @@ static struct obex_mime_type_driver pcsuite = {
 	.who_size = PCSUITE_WHO_SIZE,
 	.mimetype = "x-obex/folder-listing",
 	.open = pcsuite_open,
-	.close = string_free,
+	.close = folder_close,
 	.read = folder_read,
 };
 
@@ -600,6 +540,16 @@ static int filesystem_init(void)
 {
 	int err;
 
+	file_io_init();
+
+	if (obex_option_content_index())
+		content_index_init();
+
+	err = listing_cache_init();
+	if (err < 0)
+		error("inotify: %s (%d), folder listings are not cached",
+							strerror(-err), -err);
+
 	err = obex_mime_type_driver_register(&folder);
 	if (err < 0)
 		return err;
@@ -612,6 +562,14 @@ static int filesystem_init(void)
 	if (err < 0)
 		return err;
 
+	err = obex_mime_type_driver_register(&archive);
+	if (err < 0)
+		return err;
+
+	err = obex_mime_type_driver_register(&changes);
+	if (err < 0)
+		return err;
+
 	return obex_mime_type_driver_register(&file);
 }
 
@@ -619,7 +577,14 @@ static void filesystem_exit(void)
 {
 	obex_mime_type_driver_unregister(&folder);
 	obex_mime_type_driver_unregister(&capability);
+	obex_mime_type_driver_unregister(&archive);
+	obex_mime_type_driver_unregister(&changes);
 	obex_mime_type_driver_unregister(&file);
+
+	journal_exit();
+	listing_cache_exit();
+	capability_cache_exit();
+	file_io_exit();
 }
 
 OBEX_PLUGIN_DEFINE(filesystem, filesystem_init, filesystem_exit)
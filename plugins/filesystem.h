@@ -21,4 +21,15 @@
  *
  */
 
-ssize_t string_read(void *object, void *buf, size_t count);
+/* Buffer filled by plugins and consumed from the front by driver reads */
+struct string_buffer;
+
+struct string_buffer *string_buffer_new(const char *init);
+void string_buffer_free(struct string_buffer *sb);
+void string_buffer_append(struct string_buffer *sb, const char *data,
+								gssize len);
+void string_buffer_append_printf(struct string_buffer *sb,
+					const char *format, ...)
+					__attribute__((format(printf, 2, 3)));
+size_t string_buffer_len(struct string_buffer *sb);
+ssize_t string_buffer_read(struct string_buffer *sb, void *buf, size_t count);
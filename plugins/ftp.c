@@ -53,6 +53,8 @@
 
 #define LST_TYPE "x-obex/folder-listing"
 #define CAP_TYPE "x-obex/capability"
+#define ARCHIVE_TYPE "application/x-tar"
+#define CHANGES_TYPE "x-obex/change-listing"
 
 #define FTP_CHANNEL 10
 #define FTP_RECORD "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>		\
@@ -157,6 +159,31 @@ static void set_folder(struct ftp_session *ftp, const char *new_folder)
 	ftp->folder = new_folder ? g_strdup(new_folder) : NULL;
 }
 
+/* Action names may point into subfolders but never out of the root */
+static char *ftp_action_path(struct ftp_session *ftp, const char *name)
+{
+	char **parts;
+	char *path = NULL;
+	int i;
+
+	if (name == NULL || name[0] == '\0' || name[0] == '/')
+		return NULL;
+
+	parts = g_strsplit(name, "/", -1);
+
+	for (i = 0; parts[i]; i++) {
+		if (g_str_equal(parts[i], ".."))
+			goto done;
+	}
+
+	path = g_build_filename(ftp->folder, name, NULL);
+
+done:
+	g_strfreev(parts);
+
+	return path;
+}
+
 static int get_by_type(struct ftp_session *ftp, const char *type)
 {
 	struct obex_session *os = ftp->os;
@@ -171,7 +198,18 @@ static int get_by_type(struct ftp_session *ftp, const char *type)
 	if (g_strcmp0(type, CAP_TYPE) == 0)
 		return obex_get_stream_start(os, capability);
 
-	path = g_build_filename(ftp->folder, name, NULL);
+	/* Changes are tracked for the whole root, the name is the token */
+	if (g_strcmp0(type, CHANGES_TYPE) == 0)
+		return obex_get_stream_start(os, name ? name : "");
+
+	/* A whole tree is only archived from below the current folder */
+	if (g_strcmp0(type, ARCHIVE_TYPE) == 0 && name && *name) {
+		path = ftp_action_path(ftp, name);
+		if (path == NULL)
+			return -EBADR;
+	} else
+		path = g_build_filename(ftp->folder, name, NULL);
+
 	err = obex_get_stream_start(os, path);
 
 	g_free(path);
@@ -380,6 +418,77 @@ done:
 	return err;
 }
 
+static int ftp_setperm(const char *path, uint32_t permissions)
+{
+	uint8_t user = permissions >> 16, group = permissions >> 8;
+	uint8_t other = permissions;
+	struct stat st;
+	mode_t mode;
+
+	if (lstat(path, &st) < 0)
+		return -errno;
+
+	/* chmod() would change the target of the link instead */
+	if (S_ISLNK(st.st_mode))
+		return -EPERM;
+
+	/* Only read and write map to file modes, bit 0 and bit 1 */
+	mode = st.st_mode & ~(S_IRWXU | S_IRWXG | S_IRWXO);
+	mode |= st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH);
+	mode |= (user & 0x01 ? S_IRUSR : 0) | (user & 0x02 ? S_IWUSR : 0);
+	mode |= (group & 0x01 ? S_IRGRP : 0) | (group & 0x02 ? S_IWGRP : 0);
+	mode |= (other & 0x01 ? S_IROTH : 0) | (other & 0x02 ? S_IWOTH : 0);
+
+	/* Nor follow a link put in its place in the meantime */
+	if (fchmodat(AT_FDCWD, path, mode & 07777, AT_SYMLINK_NOFOLLOW) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int ftp_action(struct obex_session *os, obex_object_t *obj,
+							void *user_data)
+{
+	struct ftp_session *ftp = user_data;
+	const char *destname = obex_get_destname(os);
+	char *source, *destination = NULL;
+	int ret;
+
+	if (ftp->folder == NULL)
+		return -EPERM;
+
+	source = ftp_action_path(ftp, obex_get_name(os));
+	if (source == NULL)
+		return -EBADR;
+
+	switch (obex_get_action_id(os)) {
+	case OBEX_ACTION_COPY:
+	case OBEX_ACTION_MOVE:
+		destination = ftp_action_path(ftp, destname);
+		if (destination == NULL) {
+			ret = -EBADR;
+			break;
+		}
+
+		if (obex_get_action_id(os) == OBEX_ACTION_COPY)
+			ret = obex_copy(os, source, destination);
+		else
+			ret = obex_move(os, source, destination);
+		break;
+	case OBEX_ACTION_SETPERM:
+		ret = ftp_setperm(source, obex_get_permissions(os));
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	g_free(source);
+	g_free(destination);
+
+	return ret;
+}
+
 static void ftp_disconnect(struct obex_session *os, void *user_data)
 {
 	struct ftp_session *ftp = user_data;
@@ -404,6 +513,7 @@ static struct obex_service_driver pcsuite = {
 	.put = ftp_put,
 	.chkput = ftp_chkput,
 	.setpath = ftp_setpath,
+	.action = ftp_action,
 	.disconnect = ftp_disconnect
 };
 
@@ -414,11 +524,13 @@ static struct obex_service_driver ftp = {
 	.record = FTP_RECORD,
 	.target = FTP_TARGET,
 	.target_size = TARGET_SIZE,
+	.threaded = TRUE,
 	.connect = ftp_connect,
 	.get = ftp_get,
 	.put = ftp_put,
 	.chkput = ftp_chkput,
 	.setpath = ftp_setpath,
+	.action = ftp_action,
 	.disconnect = ftp_disconnect
 };
 
@@ -105,7 +105,7 @@ struct irmc_session {
 	struct obex_session *os;
 	struct apparam_field *params;
 	uint16_t entries;
-	GString *buffer;
+	struct string_buffer *buffer;
 	char sn[DID_LEN];
 	char did[DID_LEN];
 	char manu[DID_LEN];
@@ -162,15 +162,15 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 
 	/* first add a 'owner' vcard */
 	if (!irmc->buffer)
-		irmc->buffer = g_string_new(owner_vcard);
+		irmc->buffer = string_buffer_new(owner_vcard);
 	else
-		irmc->buffer = g_string_append(irmc->buffer, owner_vcard);
+		string_buffer_append(irmc->buffer, owner_vcard, -1);
 
 	/* loop around buffer and add X-IRMC-LUID attribs */
 	s = buffer;
 	while ((t = strstr(s, "UID:")) != NULL) {
 		/* add upto UID: into buffer */
-		irmc->buffer = g_string_append_len(irmc->buffer, s, t-s);
+		string_buffer_append(irmc->buffer, s, t-s);
 		/*
 		 * add UID: line into buffer
 		 * Not sure if UID is still needed if X-IRMC-LUID is there
@@ -178,16 +178,15 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 		s = t;
 		t = strstr(s, "\r\n");
 		t += 2;
-		irmc->buffer = g_string_append_len(irmc->buffer, s, t-s);
+		string_buffer_append(irmc->buffer, s, t-s);
 		/* add X-IRMC-LUID with same number as UID */
-		irmc->buffer = g_string_append_len(irmc->buffer,
-							"X-IRMC-LUID:", 12);
+		string_buffer_append(irmc->buffer, "X-IRMC-LUID:", 12);
 		s += 4; /* point to uid number */
-		irmc->buffer = g_string_append_len(irmc->buffer, s, t-s);
+		string_buffer_append(irmc->buffer, s, t-s);
 		s = t;
 	}
 	/* add remaining bit of buffer */
-	irmc->buffer = g_string_append(irmc->buffer, s);
+	string_buffer_append(irmc->buffer, s, -1);
 
 	obex_object_set_io_flags(irmc, G_IO_IN, 0);
 }
@@ -263,7 +262,7 @@ static void irmc_disconnect(struct obex_session *os, void *user_data)
 	}
 
 	if (irmc->buffer)
-		g_string_free(irmc->buffer, TRUE);
+		string_buffer_free(irmc->buffer);
 
 	g_free(irmc);
 }
@@ -278,9 +277,9 @@ static int irmc_chkput(struct obex_session *os, void *user_data)
 static void *irmc_open_devinfo(struct irmc_session *irmc, int *err)
 {
 	if (!irmc->buffer)
-		irmc->buffer = g_string_new("");
+		irmc->buffer = string_buffer_new(NULL);
 
-	g_string_append_printf(irmc->buffer,
+	string_buffer_append_printf(irmc->buffer,
 				"MANU:%s\r\n"
 				"MOD:%s\r\n"
 				"SN:%s\r\n"
@@ -358,11 +357,10 @@ static void *irmc_open_pb(const char *name, struct irmc_session *irmc,
 	}
 
 	if (!irmc->buffer)
-		irmc->buffer = mybuf;
-	else {
-		irmc->buffer = g_string_append(irmc->buffer, mybuf->str);
-		g_string_free(mybuf, TRUE);
-	}
+		irmc->buffer = string_buffer_new(NULL);
+
+	string_buffer_append(irmc->buffer, mybuf->str, mybuf->len);
+	g_string_free(mybuf, TRUE);
 
 	return irmc;
 
@@ -380,7 +378,7 @@ static void *irmc_open_cal(const char *name, struct irmc_session *irmc,
 	DBG("unsupported, returning empty buffer");
 
 	if (!irmc->buffer)
-		irmc->buffer = g_string_new("");
+		irmc->buffer = string_buffer_new(NULL);
 
 	return irmc;
 }
@@ -392,7 +390,7 @@ static void *irmc_open_nt(const char *name, struct irmc_session *irmc,
 	DBG("unsupported, returning empty buffer");
 
 	if (!irmc->buffer)
-		irmc->buffer = g_string_new("");
+		irmc->buffer = string_buffer_new(NULL);
 
 	return irmc;
 }
@@ -439,7 +437,7 @@ static int irmc_close(void *object)
 	DBG("");
 
 	if (irmc->buffer) {
-		g_string_free(irmc->buffer, TRUE);
+		string_buffer_free(irmc->buffer);
 		irmc->buffer = NULL;
 	}
 
@@ -465,7 +463,7 @@ static ssize_t irmc_read(void *object, void *buf, size_t count, uint8_t *hi,
 		*flags = 0;
 
 	*hi = OBEX_HDR_BODY;
-	len = string_read(irmc->buffer, buf, count);
+	len = string_buffer_read(irmc->buffer, buf, count);
 	DBG("returning %d bytes", len);
 	return len;
 }
@@ -0,0 +1,481 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "obex.h"
+#include "filesystem.h"
+#include "journal.h"
+
+/* Sync clients ask for what changed below the root folder since a token
+ * they got earlier instead of listing every folder again. Changes are
+ * kept in a ring, a token older than what the ring still holds (or any
+ * token after an inotify queue overflow) asks the client to resync. The
+ * journal is started by the first request, which always gets a resync. */
+#define JOURNAL_SIZE 4096
+
+#define JOURNAL_EVENTS (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+			IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+#define EOL_CHARS "\n"
+
+#define CL_VERSION "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" EOL_CHARS
+
+#define CL_BODY_BEGIN "<change-listing version=\"1.0\" token=\"%s\"%s>" \
+								EOL_CHARS
+#define CL_BODY_END "</change-listing>" EOL_CHARS
+#define CL_ELEMENT "<%s name=\"%s\"/>" EOL_CHARS
+
+struct journal_entry {
+	uint64_t seq;
+	char change;
+	char *path;
+};
+
+static struct journal_entry journal[JOURNAL_SIZE];
+static uint64_t journal_seq = 0;
+static uint64_t journal_lost = 0;
+static uint32_t journal_epoch = 0;
+static int journal_inotify = -1;
+static unsigned int journal_watch = 0;
+static gboolean journal_started = FALSE;
+static GHashTable *journal_dirs = NULL;
+G_LOCK_DEFINE_STATIC(journal);
+
+/* Called with the journal lock held */
+static void journal_record(char change, const char *dir, const char *name)
+{
+	struct journal_entry *entry;
+
+	journal_seq++;
+	entry = &journal[journal_seq % JOURNAL_SIZE];
+
+	if (entry->path) {
+		journal_lost = MAX(journal_lost, entry->seq);
+		g_free(entry->path);
+	}
+
+	entry->seq = journal_seq;
+	entry->change = change;
+	entry->path = dir[0] ? g_build_filename(dir, name, NULL) :
+							g_strdup(name);
+}
+
+/* Called with the journal lock held, every token handed out so far
+ * becomes invalid */
+static void journal_overflow(void)
+{
+	journal_seq++;
+	journal_lost = journal_seq;
+}
+
+/* Watches a folder and everything below it, entries of a folder which
+ * just appeared are recorded since they may have been created before the
+ * watch was in place. Called without the journal lock, which is only
+ * taken to record what was found, so a large tree does not hold up the
+ * other sessions while it is walked. */
+static void journal_add_tree(const char *path, gboolean created)
+{
+	char *name;
+	struct dirent *ep;
+	DIR *dp;
+	int wd, err;
+
+	name = g_build_filename(obex_option_root_folder(), path, NULL);
+
+	wd = inotify_add_watch(journal_inotify, name,
+				JOURNAL_EVENTS | IN_ONLYDIR | IN_DONT_FOLLOW);
+	if (wd < 0) {
+		err = errno;
+		error("inotify_add_watch(%s): %s(%d)", name, strerror(err),
+									err);
+		/* Running out of watches means changes go unnoticed */
+		if (err != ENOENT && err != ENOTDIR) {
+			G_LOCK(journal);
+			journal_overflow();
+			G_UNLOCK(journal);
+		}
+		g_free(name);
+		return;
+	}
+
+	G_LOCK(journal);
+	g_hash_table_replace(journal_dirs, GINT_TO_POINTER(wd),
+							g_strdup(path));
+	G_UNLOCK(journal);
+
+	dp = opendir(name);
+	g_free(name);
+
+	if (dp == NULL)
+		return;
+
+	while ((ep = readdir(dp))) {
+		struct stat st;
+		char *child;
+
+		if (ep->d_name[0] == '.')
+			continue;
+
+		if (created) {
+			G_LOCK(journal);
+			journal_record('C', path, ep->d_name);
+			G_UNLOCK(journal);
+		}
+
+		if (ep->d_type == DT_UNKNOWN) {
+			if (fstatat(dirfd(dp), ep->d_name, &st,
+						AT_SYMLINK_NOFOLLOW) < 0 ||
+						!S_ISDIR(st.st_mode))
+				continue;
+		} else if (ep->d_type != DT_DIR)
+			continue;
+
+		child = path[0] ? g_build_filename(path, ep->d_name, NULL) :
+							g_strdup(ep->d_name);
+		journal_add_tree(child, created);
+		g_free(child);
+	}
+
+	closedir(dp);
+}
+
+static gboolean journal_dir_below(void *key, void *value, void *user_data)
+{
+	const char *path = value, *prefix = user_data;
+	size_t len = strlen(prefix);
+
+	if (strncmp(path, prefix, len) != 0)
+		return FALSE;
+
+	if (path[len] != '\0' && path[len] != '/')
+		return FALSE;
+
+	inotify_rm_watch(journal_inotify, GPOINTER_TO_INT(key));
+
+	return TRUE;
+}
+
+static gboolean journal_inotify_cb(GIOChannel *io, GIOCondition cond,
+							void *user_data)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	GSList *created = NULL, *l;
+	ssize_t len;
+	char *ptr;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		error("inotify: change journal disabled");
+		G_LOCK(journal);
+		journal_overflow();
+		journal_watch = 0;
+		G_UNLOCK(journal);
+		return FALSE;
+	}
+
+	while ((len = read(journal_inotify, buf, sizeof(buf))) > 0) {
+		G_LOCK(journal);
+
+		for (ptr = buf; ptr < buf + len;
+				ptr += sizeof(*event) + event->len) {
+			const char *dir;
+			char *path;
+
+			event = (struct inotify_event *) ptr;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				DBG("change journal overflow");
+				journal_overflow();
+				continue;
+			}
+
+			if (event->mask & IN_IGNORED) {
+				g_hash_table_remove(journal_dirs,
+						GINT_TO_POINTER(event->wd));
+				continue;
+			}
+
+			dir = g_hash_table_lookup(journal_dirs,
+						GINT_TO_POINTER(event->wd));
+			if (dir == NULL || event->len == 0 ||
+						event->name[0] == '.')
+				continue;
+
+			if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				journal_record('D', dir, event->name);
+
+				if (!(event->mask & IN_ISDIR))
+					continue;
+
+				/* Moved away folders would keep reporting
+				 * under their old name */
+				path = dir[0] ? g_build_filename(dir,
+							event->name, NULL) :
+						g_strdup(event->name);
+				g_hash_table_foreach_remove(journal_dirs,
+						journal_dir_below, path);
+				g_free(path);
+			} else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+				journal_record('C', dir, event->name);
+
+				if (!(event->mask & IN_ISDIR))
+					continue;
+
+				/* Walked once the lock is released */
+				path = dir[0] ? g_build_filename(dir,
+							event->name, NULL) :
+						g_strdup(event->name);
+				created = g_slist_prepend(created, path);
+			} else
+				journal_record('M', dir, event->name);
+		}
+
+		G_UNLOCK(journal);
+
+		created = g_slist_reverse(created);
+
+		for (l = created; l; l = l->next) {
+			journal_add_tree(l->data, TRUE);
+			g_free(l->data);
+		}
+
+		g_slist_free(created);
+		created = NULL;
+	}
+
+	return TRUE;
+}
+
+/* Walks the whole tree, called by the first request without the journal
+ * lock. Requests coming meanwhile get a resync. */
+static int journal_start(void)
+{
+	GIOChannel *io;
+	unsigned int watch;
+	int fd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	G_LOCK(journal);
+	journal_inotify = fd;
+	journal_dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+								NULL, g_free);
+	journal_epoch = g_random_int();
+	G_UNLOCK(journal);
+
+	journal_add_tree("", FALSE);
+
+	io = g_io_channel_unix_new(fd);
+	watch = g_io_add_watch(io, G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+						journal_inotify_cb, NULL);
+	g_io_channel_unref(io);
+
+	G_LOCK(journal);
+
+	DBG("change journal watching %u folders",
+				g_hash_table_size(journal_dirs));
+
+	/* Nothing before this point was recorded */
+	journal_overflow();
+	journal_watch = watch;
+
+	G_UNLOCK(journal);
+
+	return 0;
+}
+
+void journal_exit(void)
+{
+	int i;
+
+	if (journal_inotify < 0)
+		return;
+
+	if (journal_watch > 0)
+		g_source_remove(journal_watch);
+
+	g_hash_table_destroy(journal_dirs);
+	journal_dirs = NULL;
+
+	for (i = 0; i < JOURNAL_SIZE; i++) {
+		g_free(journal[i].path);
+		journal[i].path = NULL;
+	}
+
+	close(journal_inotify);
+	journal_inotify = -1;
+	journal_watch = 0;
+	journal_started = FALSE;
+}
+
+/* Called with the journal lock held. Only the latest change of each
+ * path is listed, in the order those changes happened. */
+static void journal_list(struct string_buffer *buffer, uint64_t since)
+{
+	GHashTable *seen;
+	GSList *changes = NULL, *l;
+	uint64_t seq;
+
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (seq = journal_seq; seq > since; seq--) {
+		struct journal_entry *entry = &journal[seq % JOURNAL_SIZE];
+
+		/* Overflow markers have no entry */
+		if (entry->seq != seq || entry->path == NULL)
+			continue;
+
+		if (g_hash_table_lookup(seen, entry->path))
+			continue;
+
+		g_hash_table_insert(seen, entry->path, entry);
+		changes = g_slist_prepend(changes, entry);
+	}
+
+	for (l = changes; l; l = l->next) {
+		struct journal_entry *entry = l->data;
+		char *utf8, *escaped;
+
+		utf8 = g_filename_to_utf8(entry->path, -1, NULL, NULL, NULL);
+		if (utf8 == NULL)
+			continue;
+
+		escaped = g_markup_escape_text(utf8, -1);
+		string_buffer_append_printf(buffer, CL_ELEMENT,
+				entry->change == 'C' ? "created" :
+				entry->change == 'D' ? "deleted" : "modified",
+				escaped);
+		g_free(escaped);
+		g_free(utf8);
+	}
+
+	g_slist_free(changes);
+	g_hash_table_destroy(seen);
+}
+
+void *changes_open(const char *name, int oflag, mode_t mode,
+					void *context, size_t *size, int *err)
+{
+	struct string_buffer *buffer;
+	unsigned int epoch;
+	uint64_t since;
+	gboolean resync, start;
+	char token[32];
+	int ret;
+
+	if (oflag != O_RDONLY) {
+		if (err)
+			*err = -EPERM;
+		return NULL;
+	}
+
+	G_LOCK(journal);
+	start = !journal_started;
+	journal_started = TRUE;
+	G_UNLOCK(journal);
+
+	if (start) {
+		ret = journal_start();
+		if (ret < 0) {
+			G_LOCK(journal);
+			journal_started = FALSE;
+			G_UNLOCK(journal);
+			if (err)
+				*err = ret;
+			return NULL;
+		}
+	}
+
+	G_LOCK(journal);
+
+	/* Tokens are "<epoch>-<sequence>", the epoch tells a token from
+	 * a previous run apart */
+	resync = name == NULL || sscanf(name, "%x-%" SCNx64, &epoch,
+							&since) != 2 ||
+			epoch != journal_epoch || since < journal_lost ||
+			since > journal_seq || journal_watch == 0;
+
+	snprintf(token, sizeof(token), "%08x-%" PRIx64, journal_epoch,
+								journal_seq);
+
+	buffer = string_buffer_new(CL_VERSION);
+	string_buffer_append_printf(buffer, CL_BODY_BEGIN, token,
+					resync ? " resync=\"yes\"" : "");
+
+	if (!resync)
+		journal_list(buffer, since);
+
+	G_UNLOCK(journal);
+
+	string_buffer_append(buffer, CL_BODY_END, -1);
+
+	if (size)
+		*size = string_buffer_len(buffer);
+
+	if (err)
+		*err = 0;
+
+	return buffer;
+}
+
+int changes_close(void *object)
+{
+	string_buffer_free(object);
+
+	return 0;
+}
+
+ssize_t changes_read(void *object, void *buf, size_t count,
+					uint8_t *hi, unsigned int *flags)
+{
+	if (flags)
+		*flags = 0;
+
+	*hi = OBEX_HDR_BODY;
+
+	return string_buffer_read(object, buf, count);
+}
@@ -0,0 +1,337 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "listingcache.h"
+
+/* Rendered listings of unchanged folders are kept in a small LRU cache,
+ * inotify drops them as soon as anything in the folder changes */
+#define LISTING_CACHE_SIZE 16
+
+#define LISTING_EVENTS (IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | \
+			IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO)
+
+struct listing_dir {
+	int wd;
+	unsigned int changes;
+	unsigned int users;
+};
+
+static int listing_inotify = -1;
+static unsigned int listing_watch = 0;
+static GHashTable *listing_dirs = NULL;
+static GList *listing_cache = NULL;
+static unsigned int listing_hits = 0;
+static unsigned int listing_misses = 0;
+G_LOCK_DEFINE_STATIC(listing_cache);
+
+/* Called with the listing_cache lock held */
+static struct listing_dir *listing_dir_ref(const char *name)
+{
+	struct listing_dir *dir;
+	int wd;
+
+	wd = inotify_add_watch(listing_inotify, name, LISTING_EVENTS);
+	if (wd < 0) {
+		DBG("inotify_add_watch(%s): %s(%d)", name, strerror(errno),
+									errno);
+		return NULL;
+	}
+
+	dir = g_hash_table_lookup(listing_dirs, GINT_TO_POINTER(wd));
+	if (dir == NULL) {
+		dir = g_new0(struct listing_dir, 1);
+		dir->wd = wd;
+		g_hash_table_insert(listing_dirs, GINT_TO_POINTER(wd), dir);
+	}
+
+	dir->users++;
+
+	return dir;
+}
+
+/* Called with the listing_cache lock held */
+static void listing_dir_unref(struct listing_dir *dir)
+{
+	if (--dir->users > 0)
+		return;
+
+	inotify_rm_watch(listing_inotify, dir->wd);
+	g_hash_table_remove(listing_dirs, GINT_TO_POINTER(dir->wd));
+}
+
+void listing_entry_unref(struct listing_entry *entry)
+{
+	if (!g_atomic_int_dec_and_test(&entry->refs))
+		return;
+
+	g_free(entry->data);
+	g_free(entry);
+}
+
+/* Called with the listing_cache lock held */
+static void listing_cache_drop(GList *l)
+{
+	struct listing_entry *entry = l->data;
+
+	listing_cache = g_list_delete_link(listing_cache, l);
+	listing_dir_unref(entry->dir);
+	entry->dir = NULL;
+	listing_entry_unref(entry);
+}
+
+/* Called with the listing_cache lock held, NULL flushes everything */
+static void listing_cache_invalidate(struct listing_dir *dir)
+{
+	GList *l, *next;
+
+	for (l = listing_cache; l; l = next) {
+		struct listing_entry *entry = l->data;
+
+		next = l->next;
+
+		if (dir == NULL || entry->dir == dir)
+			listing_cache_drop(l);
+	}
+}
+
+static void listing_dir_changed(void *key, void *value, void *user_data)
+{
+	struct listing_dir *dir = value;
+
+	dir->changes++;
+}
+
+static gboolean listing_inotify_cb(GIOChannel *io, GIOCondition cond,
+							void *user_data)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	struct listing_dir *dir;
+	ssize_t len;
+	char *ptr;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		error("inotify: folder listing cache disabled");
+		G_LOCK(listing_cache);
+		listing_cache_invalidate(NULL);
+		G_UNLOCK(listing_cache);
+		listing_watch = 0;
+		return FALSE;
+	}
+
+	while ((len = read(listing_inotify, buf, sizeof(buf))) > 0) {
+		G_LOCK(listing_cache);
+
+		for (ptr = buf; ptr < buf + len;
+				ptr += sizeof(*event) + event->len) {
+			event = (struct inotify_event *) ptr;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				g_hash_table_foreach(listing_dirs,
+						listing_dir_changed, NULL);
+				listing_cache_invalidate(NULL);
+				continue;
+			}
+
+			dir = g_hash_table_lookup(listing_dirs,
+						GINT_TO_POINTER(event->wd));
+			if (dir == NULL)
+				continue;
+
+			dir->changes++;
+			listing_cache_invalidate(dir);
+		}
+
+		G_UNLOCK(listing_cache);
+	}
+
+	return TRUE;
+}
+
+int listing_cache_init(void)
+{
+	GIOChannel *io;
+
+	listing_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (listing_inotify < 0)
+		return -errno;
+
+	listing_dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+								NULL, g_free);
+
+	io = g_io_channel_unix_new(listing_inotify);
+	listing_watch = g_io_add_watch(io,
+				G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+				listing_inotify_cb, NULL);
+	g_io_channel_unref(io);
+
+	return 0;
+}
+
+void listing_cache_exit(void)
+{
+	if (listing_inotify < 0)
+		return;
+
+	DBG("folder listing cache: %u hits %u misses", listing_hits,
+							listing_misses);
+
+	if (listing_watch > 0)
+		g_source_remove(listing_watch);
+
+	G_LOCK(listing_cache);
+	listing_cache_invalidate(NULL);
+	G_UNLOCK(listing_cache);
+
+	g_hash_table_destroy(listing_dirs);
+	listing_dirs = NULL;
+
+	close(listing_inotify);
+	listing_inotify = -1;
+}
+
+struct listing_entry *listing_cache_lookup(struct stat *st,
+					gboolean root, gboolean symlinks,
+					gboolean pcsuite)
+{
+	struct listing_entry *entry = NULL;
+	GList *l;
+
+	if (listing_watch == 0)
+		return NULL;
+
+	G_LOCK(listing_cache);
+
+	for (l = listing_cache; l; l = l->next) {
+		struct listing_entry *e = l->data;
+
+		if (e->dev != st->st_dev || e->ino != st->st_ino ||
+				e->mtime != st->st_mtime)
+			continue;
+
+		if (e->root != root || e->symlinks != symlinks ||
+				e->pcsuite != pcsuite)
+			continue;
+
+		/* Most recently used first */
+		listing_cache = g_list_delete_link(listing_cache, l);
+		listing_cache = g_list_prepend(listing_cache, e);
+
+		g_atomic_int_inc(&e->refs);
+		entry = e;
+		break;
+	}
+
+	if (entry)
+		listing_hits++;
+	else
+		listing_misses++;
+
+	DBG("folder listing cache: %u hits %u misses", listing_hits,
+							listing_misses);
+
+	G_UNLOCK(listing_cache);
+
+	return entry;
+}
+
+/* Watches a folder before it is listed, changes is to be passed back to
+ * listing_cache_store() to tell whether anything changed in between */
+struct listing_dir *listing_dir_watch(const char *name, unsigned int *changes)
+{
+	struct listing_dir *dir;
+
+	if (listing_watch == 0)
+		return NULL;
+
+	G_LOCK(listing_cache);
+
+	dir = listing_dir_ref(name);
+	if (dir)
+		*changes = dir->changes;
+
+	G_UNLOCK(listing_cache);
+
+	return dir;
+}
+
+void listing_dir_release(struct listing_dir *dir)
+{
+	G_LOCK(listing_cache);
+	listing_dir_unref(dir);
+	G_UNLOCK(listing_cache);
+}
+
+/* Takes over the reference on dir and the listing, which is only kept if
+ * the folder did not change while it was generated */
+void listing_cache_store(struct listing_dir *dir, unsigned int changes,
+				struct stat *st, gboolean root,
+				gboolean symlinks, gboolean pcsuite,
+				GString *data)
+{
+	struct listing_entry *entry;
+
+	G_LOCK(listing_cache);
+
+	if (dir->changes != changes) {
+		listing_dir_unref(dir);
+		G_UNLOCK(listing_cache);
+		g_string_free(data, TRUE);
+		return;
+	}
+
+	entry = g_new0(struct listing_entry, 1);
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->mtime = st->st_mtime;
+	entry->root = root;
+	entry->symlinks = symlinks;
+	entry->pcsuite = pcsuite;
+	entry->len = data->len;
+	entry->data = g_string_free(data, FALSE);
+	entry->refs = 1;
+	entry->dir = dir;
+
+	listing_cache = g_list_prepend(listing_cache, entry);
+
+	if (g_list_length(listing_cache) > LISTING_CACHE_SIZE)
+		listing_cache_drop(g_list_last(listing_cache));
+
+	G_UNLOCK(listing_cache);
+}
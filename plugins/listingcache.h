@@ -0,0 +1,56 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Listings over this size are not cached */
+#define LISTING_CACHE_MAX_LEN (512 * 1024)
+
+struct listing_dir;
+
+struct listing_entry {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	gboolean root;
+	gboolean symlinks;
+	gboolean pcsuite;
+	struct listing_dir *dir;
+	char *data;
+	size_t len;
+	int refs;
+};
+
+int listing_cache_init(void);
+void listing_cache_exit(void);
+
+struct listing_dir *listing_dir_watch(const char *name, unsigned int *changes);
+void listing_dir_release(struct listing_dir *dir);
+
+struct listing_entry *listing_cache_lookup(struct stat *st,
+					gboolean root, gboolean symlinks,
+					gboolean pcsuite);
+void listing_cache_store(struct listing_dir *dir, unsigned int changes,
+				struct stat *st, gboolean root,
+				gboolean symlinks, gboolean pcsuite,
+				GString *data);
+void listing_entry_unref(struct listing_entry *entry);
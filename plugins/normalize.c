@@ -0,0 +1,86 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "normalize.h"
+
+/*
+ * Search keys are case-folded with accents stripped, so "élodie" finds
+ * "Elodie", and the result can be compared byte by byte.
+ */
+char *normalize_text(const char *str)
+{
+	char *folded, *decomposed;
+	const char *p;
+	GString *key;
+
+	if (!g_utf8_validate(str, -1, NULL))
+		return g_ascii_strdown(str, -1);
+
+	folded = g_utf8_casefold(str, -1);
+	decomposed = g_utf8_normalize(folded, -1, G_NORMALIZE_NFD);
+	g_free(folded);
+
+	key = g_string_sized_new(strlen(decomposed));
+
+	for (p = decomposed; *p; p = g_utf8_next_char(p)) {
+		gunichar c = g_utf8_get_char(p);
+
+		switch (g_unichar_type(c)) {
+		case G_UNICODE_NON_SPACING_MARK:
+		case G_UNICODE_ENCLOSING_MARK:
+			continue;
+		default:
+			g_string_append_unichar(key, c);
+		}
+	}
+
+	g_free(decomposed);
+
+	return g_string_free(key, FALSE);
+}
+
+/* Phone numbers are searched by their digits only */
+char *normalize_number(const char *str)
+{
+	char *key, *d;
+
+	key = g_malloc(strlen(str) + 1);
+
+	for (d = key; *str; str++) {
+		if (g_ascii_isdigit(*str))
+			*d++ = *str;
+	}
+
+	*d = '\0';
+
+	return key;
+}
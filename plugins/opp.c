@@ -126,6 +126,10 @@ static int opp_chkput(struct obex_session *os, void *user_data)
 
 	time = 0;
 	ret = manager_request_authorization(os, time, &folder, &name);
+	/* Called again for the result once the agent has replied */
+	if (ret == -EAGAIN)
+		return ret;
+
 	if (ret < 0)
 		return -EPERM;
 
@@ -211,6 +215,7 @@ static struct obex_service_driver driver = {
 	.service = OBEX_OPP,
 	.channel = OPP_CHANNEL,
 	.record = OPP_RECORD,
+	.threaded = TRUE,
 	.connect = opp_connect,
 	.progress = opp_progress,
 	.disconnect = opp_disconnect,
@@ -45,6 +45,7 @@
 #include "obex.h"
 #include "service.h"
 #include "phonebook.h"
+#include "pbapcache.h"
 #include "mimetype.h"
 #include "filesystem.h"
 #include "dbus.h"
@@ -122,30 +123,20 @@ struct aparam_header {
 	uint8_t val[0];
 } __attribute__ ((packed));
 
-struct cache {
-	gboolean valid;
-	uint32_t index;
-	GSList *entries;
-};
-
-struct cache_entry {
-	uint32_t handle;
-	char *id;
-	char *name;
-	char *sound;
-	char *tel;
-};
-
 struct pbap_session {
 	struct apparam_field *params;
 	char *folder;
 	uint32_t find_handle;
 	struct cache cache;
 	struct pbap_object *obj;
+	GTimer *lookup_timer;
+	unsigned int lookups;
+	unsigned int lookup_misses;
+	gdouble lookup_time;
 };
 
 struct pbap_object {
-	GString *buffer;
+	struct string_buffer *buffer;
 	GByteArray *aparams;
 	gboolean firstpacket;
 	struct pbap_session *session;
@@ -156,74 +147,25 @@ static const uint8_t PBAP_TARGET[TARGET_SIZE] = {
 			0x79, 0x61, 0x35, 0xF0,  0xF0, 0xC5, 0x11, 0xD8,
 			0x09, 0x66, 0x08, 0x00,  0x20, 0x0C, 0x9A, 0x66  };
 
-typedef int (*cache_entry_find_f) (const struct cache_entry *entry,
-			const char *value);
-
-static void cache_entry_free(struct cache_entry *entry)
+static const char *session_find(struct pbap_session *pbap, uint32_t handle)
 {
-	g_free(entry->id);
-	g_free(entry->name);
-	g_free(entry->sound);
-	g_free(entry->tel);
-	g_free(entry);
-}
-
-static gboolean entry_name_find(const struct cache_entry *entry,
-		const char *value)
-{
-	char *name;
-	gboolean ret;
-
-	if (!entry->name)
-		return FALSE;
-
-	if (strlen(value) == 0)
-		return TRUE;
-
-	name = g_utf8_strdown(entry->name, -1);
-	ret = (g_strstr_len(name, -1, value) ? TRUE : FALSE);
-	g_free(name);
-
-	return ret;
-}
-
-static gboolean entry_sound_find(const struct cache_entry *entry,
-		const char *value)
-{
-	if (!entry->sound)
-		return FALSE;
-
-	return (g_strstr_len(entry->sound, -1, value) ? TRUE : FALSE);
-}
-
-static gboolean entry_tel_find(const struct cache_entry *entry,
-		const char *value)
-{
-	if (!entry->tel)
-		return FALSE;
-
-	return (g_strstr_len(entry->tel, -1, value) ? TRUE : FALSE);
-}
+	const char *id;
+	gdouble elapsed;
 
-static const char *cache_find(struct cache *cache, uint32_t handle)
-{
-	GSList *l;
+	g_timer_start(pbap->lookup_timer);
+	id = cache_find(&pbap->cache, handle);
+	elapsed = g_timer_elapsed(pbap->lookup_timer, NULL);
 
-	for (l = cache->entries; l; l = l->next) {
-		struct cache_entry *entry = l->data;
+	pbap->lookups++;
+	pbap->lookup_time += elapsed;
+	if (id == NULL)
+		pbap->lookup_misses++;
 
-		if (entry->handle == handle)
-			return entry->id;
-	}
+	DBG("handle %u %s in %.1f us (%u entries)", handle,
+				id ? "found" : "not found", elapsed * 1e6,
+				cache_size(&pbap->cache));
 
-	return NULL;
-}
-
-static void cache_clear(struct cache *cache)
-{
-	g_slist_foreach(cache->entries, (GFunc) cache_entry_free, NULL);
-	g_slist_free(cache->entries);
-	cache->entries = NULL;
+	return id;
 }
 
 static GByteArray *append_aparam_header(GByteArray *buf, uint8_t tag,
@@ -303,10 +245,9 @@ static void query_result(const char *buffer, size_t bufsize, int vcards,
 	}
 
 	if (!pbap->obj->buffer)
-		pbap->obj->buffer = g_string_new_len(buffer, bufsize);
-	else
-		pbap->obj->buffer = g_string_append_len(pbap->obj->buffer,
-							buffer,	bufsize);
+		pbap->obj->buffer = string_buffer_new(NULL);
+
+	string_buffer_append(pbap->obj->buffer, buffer, bufsize);
 
 	if (missed > 0)	{
 		DBG("missed %d", missed);
@@ -326,77 +267,12 @@ static void cache_entry_notify(const char *id, uint32_t handle,
 					const char *tel, void *user_data)
 {
 	struct pbap_session *pbap = user_data;
-	struct cache_entry *entry = g_new0(struct cache_entry, 1);
-	struct cache *cache = &pbap->cache;
-
-	if (handle != PHONEBOOK_INVALID_HANDLE)
-		entry->handle = handle;
-	else
-		entry->handle = ++pbap->cache.index;
-
-	entry->id = g_strdup(id);
-	entry->name = g_strdup(name);
-	entry->sound = g_strdup(sound);
-	entry->tel = g_strdup(tel);
-
-	cache->entries = g_slist_append(cache->entries, entry);
-}
-
-static int alpha_sort(gconstpointer a, gconstpointer b)
-{
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
-
-	return g_strcmp0(e1->name, e2->name);
-}
-
-static int indexed_sort(gconstpointer a, gconstpointer b)
-{
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
 
-	return (e1->handle - e2->handle);
+	cache_add(&pbap->cache, id, handle, name, sound, tel);
 }
 
-static int phonetical_sort(gconstpointer a, gconstpointer b)
+static int search_field(uint8_t search_attrib)
 {
-	const struct cache_entry *e1 = a;
-	const struct cache_entry *e2 = b;
-
-	/* SOUND attribute is optional. Use Indexed sort if not present. */
-	if (!e1->sound || !e2->sound)
-		return indexed_sort(a, b);
-
-	return g_strcmp0(e1->sound, e2->sound);
-}
-
-static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
-							const char *value)
-{
-	GSList *sorted = NULL;
-	cache_entry_find_f find;
-	GCompareFunc sort;
-	char *searchval;
-
-	/*
-	 * Default sorter is "Indexed". Some backends doesn't inform the index,
-	 * for this case a sequential internal index is assigned.
-	 * 0x00 = indexed
-	 * 0x01 = alphanumeric
-	 * 0x02 = phonetic
-	 */
-	switch (order) {
-	case 0x01:
-		sort = alpha_sort;
-		break;
-	case 0x02:
-		sort = phonetical_sort;
-		break;
-	default:
-		sort = indexed_sort;
-		break;
-	}
-
 	/*
 	 * This implementation checks if the given field CONTAINS the
 	 * search value(case insensitive). Name is the default field
@@ -405,76 +281,93 @@ static GSList *sort_entries(GSList *l, uint8_t order, uint8_t search_attrib,
 	switch (search_attrib) {
 		/* Number */
 		case 1:
-			find = entry_tel_find;
-			break;
+			return CACHE_FIELD_TEL;
 		/* Sound */
 		case 2:
-			find = entry_sound_find;
-			break;
+			return CACHE_FIELD_SOUND;
 		default:
-			find = entry_name_find;
-			break;
+			return CACHE_FIELD_NAME;
 	}
-
-	searchval = value ? g_utf8_strdown(value, -1) : NULL;
-	for (; l; l = l->next) {
-		struct cache_entry *entry = l->data;
-
-		if (searchval && !find(entry, (const char *) searchval))
-			continue;
-
-		sorted = g_slist_insert_sorted(sorted, entry, sort);
-	}
-
-	g_free(searchval);
-
-	return sorted;
 }
 
 static int generate_response(void *user_data)
 {
 	struct pbap_session *pbap = user_data;
-	GSList *sorted;
-	GSList *l;
+	struct cache *cache = &pbap->cache;
 	uint16_t max = pbap->params->maxlistcount;
+	uint16_t offset = pbap->params->liststartoffset;
+	const guint *positions;
+	unsigned int i, size, matched, skipped;
+	guint8 *matches;
 
 	DBG("");
 
+	size = cache_size(cache);
+
 	if (max == 0) {
 		/* Ignore all other parameter and return PhoneBookSize */
-		uint16_t size = htons(g_slist_length(pbap->cache.entries));
+		uint16_t phonebook_size = htons(size);
 
 		pbap->obj->aparams = g_byte_array_new();
 		pbap->obj->aparams = append_aparam_header(pbap->obj->aparams,
-						PHONEBOOKSIZE_TAG, &size);
+					PHONEBOOKSIZE_TAG, &phonebook_size);
 
 		return 0;
 	}
 
-	/*
-	 * Don't free the sorted list content: this list contains
-	 * only the reference for the "real" cache entry.
-	 */
-	sorted = sort_entries(pbap->cache.entries, pbap->params->order,
-				pbap->params->searchattrib,
-				(const char *) pbap->params->searchval);
-	if (sorted == NULL)
+	if (size == 0)
 		return -ENOENT;
 
-	/* Computing offset considering first entry of the phonebook */
-	l = g_slist_nth(sorted, pbap->params->liststartoffset);
+	positions = cache_order(cache, pbap->params->order);
+	pbap->obj->buffer = string_buffer_new(VCARD_LISTING_BEGIN);
+
+	if (pbap->params->searchval == NULL) {
+		/* Computing offset considering first entry of the phonebook */
+		for (i = offset; i < size && max; i++, max--) {
+			const struct cache_entry *entry;
+
+			entry = cache_entry(cache, positions[i]);
+			string_buffer_append_printf(pbap->obj->buffer,
+				VCARD_LISTING_ELEMENT, entry->handle,
+				entry->name);
+		}
+
+		goto done;
+	}
+
+	matches = g_new0(guint8, size);
+	matched = cache_search(cache,
+				search_field(pbap->params->searchattrib),
+				(const char *) pbap->params->searchval, matches);
+
+	/* Walk the requested order, skipping entries that did not match */
+	for (i = 0, skipped = 0; i < size && max && offset < matched; i++) {
+		const struct cache_entry *entry;
 
-	pbap->obj->buffer = g_string_new(VCARD_LISTING_BEGIN);
-	for (; l && max; l = l->next, max--) {
-		const struct cache_entry *entry = l->data;
+		if (!matches[positions[i]])
+			continue;
+
+		if (skipped < offset) {
+			skipped++;
+			continue;
+		}
 
-		g_string_append_printf(pbap->obj->buffer,
+		entry = cache_entry(cache, positions[i]);
+		string_buffer_append_printf(pbap->obj->buffer,
 			VCARD_LISTING_ELEMENT, entry->handle, entry->name);
+		max--;
 	}
 
-	pbap->obj->buffer = g_string_append(pbap->obj->buffer,
-							VCARD_LISTING_END);
-	g_slist_free(sorted);
+	g_free(matches);
+
+	if (matched == 0) {
+		string_buffer_free(pbap->obj->buffer);
+		pbap->obj->buffer = NULL;
+		return -ENOENT;
+	}
+
+done:
+	string_buffer_append(pbap->obj->buffer, VCARD_LISTING_END, -1);
 
 	return 0;
 }
@@ -507,7 +400,7 @@ static void cache_entry_done(void *user_data)
 
 	pbap->cache.valid = TRUE;
 
-	id = cache_find(&pbap->cache, pbap->find_handle);
+	id = session_find(pbap, pbap->find_handle);
 	if (id == NULL) {
 		DBG("Entry %d not found on cache", pbap->find_handle);
 		obex_object_set_io_flags(pbap->obj, G_IO_ERR, -ENOENT);
@@ -613,6 +506,7 @@ static void *pbap_connect(struct obex_session *os, int *err)
 	pbap = g_new0(struct pbap_session, 1);
 	pbap->folder = g_strdup("/");
 	pbap->find_handle = PHONEBOOK_INVALID_HANDLE;
+	pbap->lookup_timer = g_timer_new();
 
 	if (err)
 		*err = 0;
@@ -733,6 +627,12 @@ static void pbap_disconnect(struct obex_session *os, void *user_data)
 		g_free(pbap->params);
 	}
 
+	if (pbap->lookups > 0)
+		DBG("%u handle lookups, %u misses, %.1f us average",
+				pbap->lookups, pbap->lookup_misses,
+				pbap->lookup_time * 1e6 / pbap->lookups);
+
+	g_timer_destroy(pbap->lookup_timer);
 	cache_clear(&pbap->cache);
 	g_free(pbap->folder);
 	g_free(pbap);
@@ -824,7 +724,7 @@ static int vobject_close(void *object)
 		obj->session->obj = NULL;
 
 	if (obj->buffer)
-		g_string_free(obj->buffer, TRUE);
+		string_buffer_free(obj->buffer);
 
 	if (obj->aparams)
 		g_byte_array_free(obj->aparams, TRUE);
@@ -914,7 +814,7 @@ static void *vobject_vcard_open(const char *name, int oflag, mode_t mode,
 		goto done;
 	}
 
-	id = cache_find(&pbap->cache, handle);
+	id = session_find(pbap, handle);
 	if (!id) {
 		ret = -ENOENT;
 		goto fail;
@@ -983,7 +883,7 @@ static ssize_t vobject_pull_read(void *object, void *buf, size_t count,
 		*hi = OBEX_HDR_BODY;
 		if (flags)
 			*flags = 0;
-		return string_read(obj->buffer, buf, count);
+		return string_buffer_read(obj->buffer, buf, count);
 	}
 }
 
@@ -1008,7 +908,7 @@ static ssize_t vobject_list_read(void *object, void *buf, size_t count,
 		return array_read(obj->aparams, buf, count);
 	} else {
 		*hi = OBEX_HDR_BODY;
-		return string_read(obj->buffer, buf, count);
+		return string_buffer_read(obj->buffer, buf, count);
 	}
 }
 
@@ -1026,7 +926,7 @@ static ssize_t vobject_vcard_read(void *object, void *buf, size_t count,
 		*flags = 0;
 
 	*hi = OBEX_HDR_BODY;
-	return string_read(obj->buffer, buf, count);
+	return string_buffer_read(obj->buffer, buf, count);
 }
 
 static struct obex_mime_type_driver mime_pull = {
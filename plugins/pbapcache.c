@@ -0,0 +1,463 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "log.h"
+#include "phonebook.h"
+#include "phonenumber.h"
+#include "normalize.h"
+#include "pbapcache.h"
+
+static char *normalize_key(int field, const char *str)
+{
+	if (field == CACHE_FIELD_TEL)
+		return normalize_number(str);
+
+	return normalize_text(str);
+}
+
+unsigned int cache_size(struct cache *cache)
+{
+	return cache->entries ? cache->entries->len : 0;
+}
+
+struct cache_entry *cache_entry(struct cache *cache, unsigned int i)
+{
+	return &g_array_index(cache->entries, struct cache_entry, i);
+}
+
+/*
+ * The handle index maps a handle to its position in the entries array
+ * plus one, so that a missing key (NULL) can be told apart from index 0.
+ * Positions are stored instead of pointers because the array may be
+ * reallocated while the cache is being filled.
+ */
+const char *cache_find(struct cache *cache, uint32_t handle)
+{
+	unsigned int pos;
+
+	if (cache->handles == NULL)
+		return NULL;
+
+	pos = GPOINTER_TO_UINT(g_hash_table_lookup(cache->handles,
+						GUINT_TO_POINTER(handle)));
+	if (pos == 0)
+		return NULL;
+
+	return cache_entry(cache, pos - 1)->id;
+}
+
+static char *cache_strdup(struct cache *cache, const char *str)
+{
+	if (str == NULL)
+		return NULL;
+
+	return g_string_chunk_insert(cache->strings, str);
+}
+
+static char *cache_key(struct cache *cache, int field, const char *str)
+{
+	char *key, *ret;
+
+	if (str == NULL)
+		return NULL;
+
+	key = normalize_key(field, str);
+	ret = cache_strdup(cache, key);
+	g_free(key);
+
+	return ret;
+}
+
+static void cache_indexes_clear(struct cache *cache)
+{
+	int i;
+
+	for (i = 0; i < CACHE_ORDERS; i++) {
+		g_free(cache->orders[i]);
+		cache->orders[i] = NULL;
+	}
+
+	for (i = 0; i < CACHE_FIELDS; i++) {
+		if (cache->grams[i] == NULL)
+			continue;
+
+		g_hash_table_destroy(cache->grams[i]);
+		cache->grams[i] = NULL;
+	}
+
+	phonenumber_index_free(cache->numbers);
+	cache->numbers = NULL;
+}
+
+void cache_clear(struct cache *cache)
+{
+	cache_indexes_clear(cache);
+
+	if (cache->entries) {
+		g_array_free(cache->entries, TRUE);
+		cache->entries = NULL;
+	}
+
+	if (cache->strings) {
+		g_string_chunk_free(cache->strings);
+		cache->strings = NULL;
+	}
+
+	if (cache->handles) {
+		g_hash_table_destroy(cache->handles);
+		cache->handles = NULL;
+	}
+}
+
+void cache_add(struct cache *cache, const char *id, uint32_t handle,
+			const char *name, const char *sound, const char *tel)
+{
+	struct cache_entry entry;
+
+	if (cache->entries == NULL) {
+		cache->entries = g_array_new(FALSE, FALSE,
+						sizeof(struct cache_entry));
+		cache->strings = g_string_chunk_new(4096);
+		cache->handles = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+	}
+
+	if (handle != PHONEBOOK_INVALID_HANDLE)
+		entry.handle = handle;
+	else
+		entry.handle = ++cache->index;
+
+	entry.id = cache_strdup(cache, id);
+	entry.name = cache_strdup(cache, name);
+	entry.sound = cache_strdup(cache, sound);
+	entry.tel = cache_strdup(cache, tel);
+
+	entry.keys[CACHE_FIELD_NAME] = cache_key(cache, CACHE_FIELD_NAME,
+									name);
+	entry.keys[CACHE_FIELD_TEL] = cache_key(cache, CACHE_FIELD_TEL, tel);
+	entry.keys[CACHE_FIELD_SOUND] = cache_key(cache, CACHE_FIELD_SOUND,
+									sound);
+
+	g_array_append_val(cache->entries, entry);
+	cache_indexes_clear(cache);
+
+	/* Keep the first entry for a handle, as the linear scan used to */
+	if (g_hash_table_lookup(cache->handles,
+				GUINT_TO_POINTER(entry.handle)) == NULL)
+		g_hash_table_insert(cache->handles,
+				GUINT_TO_POINTER(entry.handle),
+				GUINT_TO_POINTER(cache->entries->len));
+}
+
+static int alpha_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = a;
+	const struct cache_entry *e2 = b;
+
+	return g_strcmp0(e1->name, e2->name);
+}
+
+static int indexed_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = a;
+	const struct cache_entry *e2 = b;
+
+	if (e1->handle == e2->handle)
+		return 0;
+
+	return (e1->handle < e2->handle ? -1 : 1);
+}
+
+static int phonetical_sort(gconstpointer a, gconstpointer b)
+{
+	const struct cache_entry *e1 = a;
+	const struct cache_entry *e2 = b;
+
+	/* SOUND attribute is optional. Use Indexed sort if not present. */
+	if (!e1->sound || !e2->sound)
+		return indexed_sort(a, b);
+
+	return g_strcmp0(e1->sound, e2->sound);
+}
+
+struct order_data {
+	struct cache *cache;
+	GCompareFunc sort;
+};
+
+static int order_compare(gconstpointer a, gconstpointer b,
+							gpointer user_data)
+{
+	struct order_data *data = user_data;
+	guint p1 = *(const guint *) a;
+	guint p2 = *(const guint *) b;
+	int ret;
+
+	ret = data->sort(cache_entry(data->cache, p1),
+					cache_entry(data->cache, p2));
+	if (ret != 0)
+		return ret;
+
+	/* Equal keys keep the order the backend reported them in */
+	return (p1 < p2 ? -1 : p1 > p2);
+}
+
+/*
+ * Returns the cache positions in the requested order. Each ordering is
+ * sorted once, on first use, and kept until the cache contents change,
+ * so paging through a listing only costs the offset lookup.
+ */
+const guint *cache_order(struct cache *cache, uint8_t order)
+{
+	struct order_data data;
+	unsigned int i, size;
+	guint *positions;
+
+	/*
+	 * Default sorter is "Indexed". Some backends doesn't inform the index,
+	 * for this case a sequential internal index is assigned.
+	 * 0x00 = indexed
+	 * 0x01 = alphanumeric
+	 * 0x02 = phonetic
+	 */
+	switch (order) {
+	case 0x01:
+		data.sort = alpha_sort;
+		break;
+	case 0x02:
+		data.sort = phonetical_sort;
+		break;
+	default:
+		order = 0x00;
+		data.sort = indexed_sort;
+		break;
+	}
+
+	if (cache->orders[order])
+		return cache->orders[order];
+
+	size = cache_size(cache);
+	positions = g_new(guint, size ? size : 1);
+	for (i = 0; i < size; i++)
+		positions[i] = i;
+
+	data.cache = cache;
+	g_qsort_with_data(positions, size, sizeof(guint), order_compare,
+									&data);
+
+	DBG("order 0x%02x built for %u entries", order, size);
+
+	cache->orders[order] = positions;
+
+	return positions;
+}
+
+/* Trigrams are packed into a pointer-sized key; keys have no NUL bytes */
+static gpointer gram_key(const char *p)
+{
+	guint32 key;
+
+	key = (guint8) p[0] | (guint8) p[1] << 8 | (guint8) p[2] << 16;
+
+	return GUINT_TO_POINTER(key);
+}
+
+static void postings_free(gpointer data)
+{
+	g_array_free(data, TRUE);
+}
+
+/*
+ * Maps every trigram of a field's search keys to the ascending list of
+ * cache positions containing it. Built on the first search of the field
+ * and kept until the cache contents change.
+ */
+static GHashTable *cache_grams(struct cache *cache, int field)
+{
+	GHashTable *grams;
+	unsigned int i;
+
+	if (cache->grams[field])
+		return cache->grams[field];
+
+	grams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+								postings_free);
+
+	for (i = 0; i < cache_size(cache); i++) {
+		const char *key = cache_entry(cache, i)->keys[field];
+		size_t len, j;
+
+		if (key == NULL)
+			continue;
+
+		len = strlen(key);
+
+		for (j = 0; j + 3 <= len; j++) {
+			GArray *postings;
+
+			postings = g_hash_table_lookup(grams,
+							gram_key(key + j));
+			if (postings == NULL) {
+				postings = g_array_new(FALSE, FALSE,
+							sizeof(guint));
+				g_hash_table_insert(grams, gram_key(key + j),
+								postings);
+			}
+
+			if (postings->len > 0 && g_array_index(postings, guint,
+						postings->len - 1) == i)
+				continue;
+
+			g_array_append_val(postings, i);
+		}
+	}
+
+	DBG("field %d: %u trigrams for %u entries", field,
+				g_hash_table_size(grams), cache_size(cache));
+
+	cache->grams[field] = grams;
+
+	return grams;
+}
+
+/*
+ * Marks in matches every entry whose field CONTAINS the search value,
+ * compared on the normalized keys, and returns how many were found.
+ * Values of at least three bytes only verify the entries listed under
+ * their rarest trigram; shorter ones have to check every entry.
+ */
+static unsigned int cache_key_search(struct cache *cache, int field,
+					const char *value, guint8 *matches)
+{
+	GArray *candidates = NULL;
+	unsigned int i, count, found = 0;
+	size_t len, j;
+	char *key;
+
+	key = normalize_key(field, value);
+	len = strlen(key);
+
+	/* Nothing searchable is left, e.g. a number without digits */
+	if (len == 0 && value[0] != '\0')
+		goto done;
+
+	if (len >= 3) {
+		GHashTable *grams = cache_grams(cache, field);
+
+		for (j = 0; j + 3 <= len; j++) {
+			GArray *postings;
+
+			postings = g_hash_table_lookup(grams,
+							gram_key(key + j));
+			if (postings == NULL)
+				goto done;
+
+			if (candidates == NULL ||
+					postings->len < candidates->len)
+				candidates = postings;
+		}
+	}
+
+	count = candidates ? candidates->len : cache_size(cache);
+
+	for (i = 0; i < count; i++) {
+		guint pos = candidates ?
+				g_array_index(candidates, guint, i) : i;
+		const char *entry_key = cache_entry(cache, pos)->keys[field];
+
+		if (entry_key == NULL || strstr(entry_key, key) == NULL)
+			continue;
+
+		matches[pos] = 1;
+		found++;
+	}
+
+	DBG("field %d: %u matches from %u candidates", field, found, count);
+
+done:
+	g_free(key);
+
+	return found;
+}
+
+static struct phonenumber_index *cache_numbers(struct cache *cache)
+{
+	unsigned int i;
+
+	if (cache->numbers)
+		return cache->numbers;
+
+	cache->numbers = phonenumber_index_new(PHONENUMBER_MATCH_DIGITS);
+
+	for (i = 0; i < cache_size(cache); i++) {
+		const char *tel = cache_entry(cache, i)->tel;
+
+		if (tel)
+			phonenumber_index_add(cache->numbers, tel,
+							GUINT_TO_POINTER(i));
+	}
+
+	return cache->numbers;
+}
+
+/*
+ * Number searches also find the entries whose number matches the search
+ * value as a phone number, e.g. a caller ID in international form.
+ */
+unsigned int cache_search(struct cache *cache, int field,
+					const char *value, guint8 *matches)
+{
+	unsigned int found;
+	GSList *numbers, *l;
+
+	found = cache_key_search(cache, field, value, matches);
+
+	if (field != CACHE_FIELD_TEL)
+		return found;
+
+	numbers = phonenumber_index_lookup(cache_numbers(cache), value);
+
+	for (l = numbers; l; l = l->next) {
+		guint pos = GPOINTER_TO_UINT(l->data);
+
+		if (matches[pos])
+			continue;
+
+		matches[pos] = 1;
+		found++;
+	}
+
+	g_slist_free(numbers);
+
+	return found;
+}
@@ -0,0 +1,66 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Indexed, alphanumeric and phonetic listing orders */
+#define CACHE_ORDERS		3
+
+/* Searchable fields, numbered as the SearchAttribute values */
+#define CACHE_FIELD_NAME	0
+#define CACHE_FIELD_TEL		1
+#define CACHE_FIELD_SOUND	2
+#define CACHE_FIELDS		3
+
+/* Entries are kept in one array and their strings in one chunk, so
+ * building the cache costs a few reallocations instead of five heap
+ * allocations per contact and clearing it is two frees */
+
+struct cache {
+	gboolean valid;
+	uint32_t index;
+	GArray *entries;
+	GStringChunk *strings;
+	GHashTable *handles;
+	guint *orders[CACHE_ORDERS];
+	GHashTable *grams[CACHE_FIELDS];
+	struct phonenumber_index *numbers;
+};
+
+struct cache_entry {
+	uint32_t handle;
+	char *id;
+	char *name;
+	char *sound;
+	char *tel;
+	char *keys[CACHE_FIELDS];	/* normalized for searching */
+};
+
+unsigned int cache_size(struct cache *cache);
+struct cache_entry *cache_entry(struct cache *cache, unsigned int i);
+const char *cache_find(struct cache *cache, uint32_t handle);
+void cache_add(struct cache *cache, const char *id, uint32_t handle,
+			const char *name, const char *sound, const char *tel);
+void cache_clear(struct cache *cache);
+const guint *cache_order(struct cache *cache, uint8_t order);
+unsigned int cache_search(struct cache *cache, int field,
+					const char *value, guint8 *matches);
@@ -37,6 +37,7 @@
 #include "phonebook.h"
 #include "dbus.h"
 #include "vcard.h"
+#include "phonenumber.h"
 
 #define TRACKER_SERVICE "org.freedesktop.Tracker1"
 #define TRACKER_RESOURCES_PATH "/org/freedesktop/Tracker1/Resources"
@@ -915,6 +916,7 @@ struct phonebook_data {
 	gboolean vcardentry;
 	const struct apparam_field *params;
 	GSList *contacts;
+	struct phonenumber_index *checked;
 	phonebook_cache_ready_cb ready_cb;
 	phonebook_entry_cb entry_cb;
 	int newmissedcalls;
@@ -1801,25 +1803,22 @@ void phonebook_req_finalize(void *request)
 	dbus_pending_call_unref(data->call);
 
 	g_slist_free(data->contacts);
+	phonenumber_index_free(data->checked);
 	g_free(data);
 }
 
-static gboolean find_checked_number(GSList *numbers, const char *number)
+static gboolean find_checked_number(struct phonenumber_index *numbers,
+							const char *number)
 {
-	GSList *l;
+	GSList *matches;
 
-	for (l = numbers; l; l = l->next) {
-		GString *ph_num = l->data;
-		if (g_strcmp0(ph_num->str, number) == 0)
-			return TRUE;
-	}
+	if (numbers == NULL || number == NULL)
+		return FALSE;
 
-	return FALSE;
-}
+	matches = phonenumber_index_lookup(numbers, number);
+	g_slist_free(matches);
 
-static void gstring_free_helper(gpointer data, gpointer user_data)
-{
-	g_string_free(data, TRUE);
+	return matches != NULL;
 }
 
 static void pull_newmissedcalls(char **reply, int num_fields, void *user_data)
@@ -1832,22 +1831,23 @@ static void pull_newmissedcalls(char **reply, int num_fields, void *user_data)
 	if (num_fields < 0 || reply == NULL)
 		goto done;
 
-	if (!find_checked_number(data->contacts, reply[1])) {
+	if (!find_checked_number(data->checked, reply[1])) {
 		if (g_strcmp0(reply[2], "false") == 0)
 			data->newmissedcalls++;
-		else {
-			GString *number = g_string_new(reply[1]);
-			data->contacts = g_slist_append(data->contacts,
-								number);
+		else if (reply[1] != NULL) {
+			if (data->checked == NULL)
+				data->checked = phonenumber_index_new(
+						PHONENUMBER_MATCH_DIGITS);
+
+			phonenumber_index_add(data->checked, reply[1], NULL);
 		}
 	}
 	return;
 
 done:
 	DBG("newmissedcalls %d", data->newmissedcalls);
-	g_slist_foreach(data->contacts, gstring_free_helper, NULL);
-	g_slist_free(data->contacts);
-	data->contacts = NULL;
+	phonenumber_index_free(data->checked);
+	data->checked = NULL;
 
 	if (num_fields < 0) {
 		data->cb(NULL, 0, num_fields, 0, data->user_data);
@@ -0,0 +1,190 @@
+/*
+ * OBEX Server
+ *
+ * Copyright (C) 2008-2010 Intel Corporation.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "phonenumber.h"
+
+struct phonenumber_index {
+	unsigned int digits;
+	GHashTable *numbers;
+};
+
+struct phonenumber_entry {
+	char *digits;
+	void *data;
+};
+
+/*
+ * Reduces a number to its digits. The international prefix is dropped,
+ * whether written as "+" or as "00", so "+44 20 7946 0000" and
+ * "0044 (20) 7946-0000" both become "442079460000". So is the trunk
+ * prefix of a national number, "020 7946 0000" becomes "2079460000".
+ */
+char *phonenumber_normalize(const char *number)
+{
+	char *digits, *d;
+
+	while (*number && !g_ascii_isdigit(*number) && *number != '+')
+		number++;
+
+	if (*number == '+')
+		number++;
+	else if (g_str_has_prefix(number, "00"))
+		number += 2;
+	else if (*number == '0')
+		number++;
+
+	digits = g_malloc(strlen(number) + 1);
+
+	for (d = digits; *number; number++) {
+		if (g_ascii_isdigit(*number))
+			*d++ = *number;
+	}
+
+	*d = '\0';
+
+	return digits;
+}
+
+/* Compares normalized numbers, the shorter must end the longer one */
+static gboolean digits_match(const char *a, const char *b)
+{
+	if (strlen(a) < strlen(b))
+		return g_str_has_suffix(b, a);
+
+	return g_str_has_suffix(a, b);
+}
+
+/*
+ * Numbers of at least index->digits digits are keyed by that many
+ * trailing digits, shorter ones (e.g. service codes) by all of them.
+ * Only numbers of the same bucket can match, which is then confirmed
+ * with the whole numbers.
+ */
+static char *index_key(struct phonenumber_index *index, const char *digits)
+{
+	size_t len = strlen(digits);
+
+	if (len <= index->digits)
+		return g_strdup(digits);
+
+	return g_strdup(digits + len - index->digits);
+}
+
+static void bucket_free(gpointer data)
+{
+	GSList *l;
+
+	for (l = data; l; l = l->next) {
+		struct phonenumber_entry *entry = l->data;
+
+		g_free(entry->digits);
+		g_free(entry);
+	}
+
+	g_slist_free(data);
+}
+
+struct phonenumber_index *phonenumber_index_new(unsigned int digits)
+{
+	struct phonenumber_index *index;
+
+	index = g_new0(struct phonenumber_index, 1);
+	index->digits = digits;
+	index->numbers = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, bucket_free);
+
+	return index;
+}
+
+void phonenumber_index_free(struct phonenumber_index *index)
+{
+	if (index == NULL)
+		return;
+
+	g_hash_table_destroy(index->numbers);
+	g_free(index);
+}
+
+void phonenumber_index_add(struct phonenumber_index *index,
+					const char *number, void *data)
+{
+	struct phonenumber_entry *entry;
+	GSList *bucket;
+	char *digits, *key;
+
+	digits = phonenumber_normalize(number);
+	if (*digits == '\0') {
+		g_free(digits);
+		return;
+	}
+
+	entry = g_new0(struct phonenumber_entry, 1);
+	entry->digits = digits;
+	entry->data = data;
+
+	key = index_key(index, digits);
+
+	/* The bucket head must stay in place, so new entries go second */
+	bucket = g_hash_table_lookup(index->numbers, key);
+	if (bucket) {
+		bucket->next = g_slist_prepend(bucket->next, entry);
+		g_free(key);
+		return;
+	}
+
+	g_hash_table_insert(index->numbers, key, g_slist_prepend(NULL, entry));
+}
+
+/*
+ * Returns the data of every indexed number matching the given one, or
+ * NULL if there is none. The list is to be freed with g_slist_free().
+ */
+GSList *phonenumber_index_lookup(struct phonenumber_index *index,
+							const char *number)
+{
+	GSList *bucket, *matches = NULL;
+	char *digits, *key;
+
+	digits = phonenumber_normalize(number);
+	if (*digits == '\0') {
+		g_free(digits);
+		return NULL;
+	}
+
+	key = index_key(index, digits);
+	bucket = g_hash_table_lookup(index->numbers, key);
+	g_free(key);
+
+	for (; bucket; bucket = bucket->next) {
+		struct phonenumber_entry *entry = bucket->data;
+
+		if (digits_match(entry->digits, digits))
+			matches = g_slist_prepend(matches, entry->data);
+	}
+
+	g_free(digits);
+
+	return g_slist_reverse(matches);
+}
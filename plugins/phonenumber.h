@@ -0,0 +1,45 @@
+/*
+ * OBEX Server
+ *
+ * Copyright (C) 2008-2010 Intel Corporation.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Numbers are looked up by their last PHONENUMBER_MATCH_DIGITS digits and
+ * match when the shorter one, normalized, is the end of the longer one.
+ * National and international forms of a number are found whatever
+ * formatting the backend stored them with, while numbers only sharing
+ * their last digits are not.
+ *
+ * Lookups need at least PHONENUMBER_MATCH_DIGITS digits to find longer
+ * numbers. A shorter value, e.g. the last four digits, only finds the
+ * numbers that short, such as service codes. Partial numbers are found
+ * by the substring search on the normalized keys instead.
+ */
+#define PHONENUMBER_MATCH_DIGITS 7
+
+struct phonenumber_index;
+
+char *phonenumber_normalize(const char *number);
+
+struct phonenumber_index *phonenumber_index_new(unsigned int digits);
+void phonenumber_index_free(struct phonenumber_index *index);
+void phonenumber_index_add(struct phonenumber_index *index,
+					const char *number, void *data);
+GSList *phonenumber_index_lookup(struct phonenumber_index *index,
+							const char *number);
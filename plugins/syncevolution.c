@@ -95,7 +95,7 @@ struct synce_context {
 	char *conn_obj;
 	unsigned int reply_watch;
 	unsigned int abort_watch;
-	GString *buffer;
+	struct string_buffer *buffer;
 	int lasterr;
 	char *id;
 };
@@ -132,7 +132,11 @@ static gboolean reply_signal(DBusConnection *conn, DBusMessage *msg,
 	dbus_message_iter_recurse(&iter, &array_iter);
 	dbus_message_iter_get_fixed_array(&array_iter, &value, &length);
 
-	context->buffer = g_string_new_len(value, length);
+	if (context->buffer)
+		string_buffer_free(context->buffer);
+
+	context->buffer = string_buffer_new(NULL);
+	string_buffer_append(context->buffer, value, length);
 	obex_object_set_io_flags(context, G_IO_IN, 0);
 	context->lasterr = 0;
 
@@ -326,6 +330,9 @@ failed:
 	context->conn_obj = NULL;
 
 done:
+	if (context->buffer)
+		string_buffer_free(context->buffer);
+
 	dbus_connection_unref(context->dbus_conn);
 	g_free(context);
 	return 0;
@@ -348,7 +355,7 @@ static ssize_t synce_read(void *object, void *buf, size_t count,
 
 	if (context->buffer) {
 		*hi = OBEX_HDR_BODY;
-		return string_read(context->buffer, buf, count);
+		return string_buffer_read(context->buffer, buf, count);
 	}
 
 	conn = obex_dbus_get_connection();
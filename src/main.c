@@ -51,6 +51,7 @@
 #include "obex-priv.h"
 #include "server.h"
 #include "service.h"
+#include "worker.h"
 
 #define DEFAULT_ROOT_PATH "/tmp"
 
@@ -83,7 +84,14 @@ static gboolean option_pbap = FALSE;
 static gboolean option_irmc = FALSE;
 static gboolean option_pcsuite = FALSE;
 static gboolean option_symlinks = FALSE;
+static gboolean option_async_io = FALSE;
+static gboolean option_content_index = FALSE;
+static char *option_durability = NULL;
+static enum obex_durability durability = OBEX_DURABILITY_NONE;
 static gboolean option_syncevolution = FALSE;
+static int option_threads = 0;
+static int option_progress_interval = 0;
+static int option_progress_bytes = 0;
 
 static gboolean parse_debug(const char *key, const char *value,
 				gpointer user_data, GError **error)
@@ -109,6 +117,11 @@ static GOptionEntry options[] = {
 				"Root folder setup script", "SCRIPT" },
 	{ "symlinks", 'l', 0, G_OPTION_ARG_NONE, &option_symlinks,
 				"Enable symlinks on root folder" },
+	{ "content-index", 'H', 0, G_OPTION_ARG_NONE, &option_content_index,
+				"Hash received files and share identical content" },
+	{ "durability", 'D', 0, G_OPTION_ARG_STRING, &option_durability,
+				"When received files are synced to disk "
+				"(none, end or periodic)", "POLICY" },
 	{ "capability", 'c', 0, G_OPTION_ARG_STRING, &option_capability,
 				"Specify capability file", "FILE" },
 	{ "auto-accept", 'a', 0, G_OPTION_ARG_NONE, &option_autoaccept,
@@ -125,6 +138,19 @@ static GOptionEntry options[] = {
 				"Enable PC Suite Services server" },
 	{ "syncevolution", 'e', 0, G_OPTION_ARG_NONE, &option_syncevolution,
 				"Enable OBEX server for SyncEvolution" },
+	{ "progress-interval", 'P', 0, G_OPTION_ARG_INT,
+				&option_progress_interval,
+				"Minimum time between progress signals",
+				"MSEC" },
+	{ "progress-bytes", 'B', 0, G_OPTION_ARG_INT,
+				&option_progress_bytes,
+				"Emit progress after this many bytes", "BYTES" },
+#ifdef HAVE_THREADS
+	{ "async-io", 'A', 0, G_OPTION_ARG_NONE, &option_async_io,
+				"Do file reads and writes in background threads" },
+	{ "threads", 't', 0, G_OPTION_ARG_INT, &option_threads,
+				"Run sessions in worker threads", "NUM" },
+#endif
 	{ NULL },
 };
 
@@ -138,6 +164,31 @@ gboolean obex_option_symlinks(void)
 	return option_symlinks;
 }
 
+gboolean obex_option_async_io(void)
+{
+	return option_async_io;
+}
+
+gboolean obex_option_content_index(void)
+{
+	return option_content_index;
+}
+
+enum obex_durability obex_option_durability(void)
+{
+	return durability;
+}
+
+unsigned int obex_option_progress_interval(void)
+{
+	return MAX(option_progress_interval, 0);
+}
+
+unsigned int obex_option_progress_bytes(void)
+{
+	return MAX(option_progress_bytes, 0);
+}
+
 static gboolean is_dir(const char *dir) {
 	struct stat st;
 
@@ -202,6 +253,16 @@ int main(int argc, char *argv[])
 
 	g_option_context_free(context);
 
+	if (g_strcmp0(option_durability, "end") == 0)
+		durability = OBEX_DURABILITY_END;
+	else if (g_strcmp0(option_durability, "periodic") == 0)
+		durability = OBEX_DURABILITY_PERIODIC;
+	else if (option_durability && !g_str_equal(option_durability, "none")) {
+		fprintf(stderr, "Unknown durability policy %s (use either "
+				"none, end or periodic)\n", option_durability);
+		exit(EXIT_FAILURE);
+	}
+
 	if (option_detach == TRUE) {
 		if (daemon(0, 0)) {
 			perror("Can't start daemon");
@@ -252,6 +313,9 @@ int main(int argc, char *argv[])
 	if (option_capability == NULL)
 		option_capability = g_strdup(DEFAULT_CAP_FILE);
 
+	if (option_threads > 0)
+		obex_worker_init(option_threads);
+
 	if (option_opp == TRUE)
 		obex_server_init(OBEX_OPP, option_root, FALSE,
 				option_autoaccept, option_symlinks,
@@ -295,6 +359,8 @@ int main(int argc, char *argv[])
 
 	obex_server_exit();
 
+	obex_worker_exit();
+
 	plugin_cleanup();
 
 	manager_cleanup();
@@ -45,6 +45,8 @@
 #include "log.h"
 #include "btio.h"
 #include "service.h"
+#include "worker.h"
+#include "mimetype.h"
 
 #define OPENOBEX_MANAGER_PATH "/"
 #define OPENOBEX_MANAGER_INTERFACE OPENOBEX_SERVICE ".Manager"
@@ -57,23 +59,91 @@
 struct agent {
 	char *bus_name;
 	char *path;
-	gboolean auth_pending;
+	unsigned int watch_id;
+};
+
+/* Authorization waiting on the agent, indexed by transfer path */
+struct auth_request {
+	struct obex_session *os;
+	DBusPendingCall *call;
+	unsigned int watch;
+	unsigned int resume;
+	gboolean done;
+	int err;
 	char *new_name;
 	char *new_folder;
-	unsigned int watch_id;
+};
+
+struct manager_call {
+	void (*func) (struct obex_session *os);
+	struct obex_session *os;
+};
+
+struct auth_call {
+	struct obex_session *os;
+	int32_t time;
+	char **new_folder;
+	char **new_name;
+	int ret;
 };
 
 static struct agent *agent = NULL;
+static GHashTable *auth_requests = NULL;
 
 static DBusConnection *connection = NULL;
 
+static gboolean manager_call_cb(void *user_data)
+{
+	struct manager_call *call = user_data;
+
+	call->func(call->os);
+
+	return FALSE;
+}
+
+/* gdbus and the agent are only touched from the main loop, sessions
+ * running in worker threads wait for the call to complete */
+static void call_in_main(void (*func) (struct obex_session *os),
+						struct obex_session *os)
+{
+	struct manager_call call = { func, os };
+
+	obex_worker_call_main(manager_call_cb, &call);
+}
+
+static void auth_request_free(void *data)
+{
+	struct auth_request *req = data;
+
+	if (req->watch > 0)
+		g_source_remove(req->watch);
+
+	if (req->resume > 0)
+		g_source_remove(req->resume);
+
+	if (req->call) {
+		dbus_pending_call_cancel(req->call);
+		dbus_pending_call_unref(req->call);
+	}
+
+	g_free(req->new_folder);
+	g_free(req->new_name);
+	g_free(req);
+}
+
+static void cancel_authorization(struct obex_session *os)
+{
+	if (os->transfer_path == NULL)
+		return;
+
+	g_hash_table_remove(auth_requests, os->transfer_path);
+}
+
 static void agent_free(struct agent *agent)
 {
 	if (!agent)
 		return;
 
-	g_free(agent->new_folder);
-	g_free(agent->new_name);
 	g_free(agent->bus_name);
 	g_free(agent->path);
 	g_free(agent);
@@ -358,6 +428,9 @@ gboolean manager_init(void)
 		return FALSE;
 	}
 
+	auth_requests = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, auth_request_free);
+
 	return g_dbus_register_interface(connection, OPENOBEX_MANAGER_PATH,
 					OPENOBEX_MANAGER_INTERFACE,
 					manager_methods, manager_signals, NULL,
@@ -376,76 +449,95 @@ void manager_cleanup(void)
 	if (agent)
 		agent_free(agent);
 
+	if (auth_requests)
+		g_hash_table_destroy(auth_requests);
+
 	dbus_connection_unref(connection);
 }
 
-void manager_emit_transfer_started(struct obex_session *os)
+/* The transfer path never changes for a session, format it only once */
+static const char *transfer_path(struct obex_session *os)
 {
-	char *path = g_strdup_printf("/transfer%u", os->cid);
-
-	g_dbus_emit_signal(connection, OPENOBEX_MANAGER_PATH,
-			OPENOBEX_MANAGER_INTERFACE, "TransferStarted",
-			DBUS_TYPE_OBJECT_PATH, &path,
-			DBUS_TYPE_INVALID);
+	if (os->transfer_path == NULL)
+		os->transfer_path = g_strdup_printf("/transfer%u", os->cid);
 
-	g_free(path);
+	return os->transfer_path;
 }
 
-static void emit_transfer_completed(uint32_t id, gboolean success)
+static void emit_transfer_started(struct obex_session *os)
 {
-	char *path = g_strdup_printf("/transfer%u", id);
+	const char *path = transfer_path(os);
+
+	os->progress_offset = 0;
+	if (os->progress_timer)
+		g_timer_start(os->progress_timer);
 
 	g_dbus_emit_signal(connection, OPENOBEX_MANAGER_PATH,
-			OPENOBEX_MANAGER_INTERFACE, "TransferCompleted",
+			OPENOBEX_MANAGER_INTERFACE, "TransferStarted",
 			DBUS_TYPE_OBJECT_PATH, &path,
-			DBUS_TYPE_BOOLEAN, &success,
 			DBUS_TYPE_INVALID);
-
-	g_free(path);
 }
 
-static void emit_transfer_progress(uint32_t id, uint32_t total,
-							uint32_t transfered)
+static void emit_transfer_progress(struct obex_session *os)
 {
-	char *path = g_strdup_printf("/transfer%u", id);
+	const char *path = transfer_path(os);
+	uint32_t total = os->size;
+	uint32_t transfered = os->offset;
+
+	os->progress_offset = os->offset;
+	if (os->progress_timer)
+		g_timer_start(os->progress_timer);
 
 	g_dbus_emit_signal(connection, path,
 			TRANSFER_INTERFACE, "Progress",
 			DBUS_TYPE_INT32, &total,
 			DBUS_TYPE_INT32, &transfered,
 			DBUS_TYPE_INVALID);
+}
 
-	g_free(path);
+static void emit_transfer_completed(struct obex_session *os,
+							gboolean success)
+{
+	const char *path = transfer_path(os);
+
+	/* Coalescing may have held back the last update */
+	if (os->offset != os->progress_offset)
+		emit_transfer_progress(os);
+
+	g_dbus_emit_signal(connection, OPENOBEX_MANAGER_PATH,
+			OPENOBEX_MANAGER_INTERFACE, "TransferCompleted",
+			DBUS_TYPE_OBJECT_PATH, &path,
+			DBUS_TYPE_BOOLEAN, &success,
+			DBUS_TYPE_INVALID);
+
+	os->progress_offset = 0;
 }
 
-void manager_register_transfer(struct obex_session *os)
+static void register_transfer(struct obex_session *os)
 {
-	char *path = g_strdup_printf("/transfer%u", os->cid);
+	const char *path = transfer_path(os);
 
 	if (!g_dbus_register_interface(connection, path,
 				TRANSFER_INTERFACE,
 				transfer_methods, transfer_signals,
 				NULL, os, NULL)) {
 		error("Cannot register Transfer interface.");
-		g_free(path);
 		return;
 	}
-
-	g_free(path);
 }
 
-void manager_unregister_transfer(struct obex_session *os)
+static void unregister_transfer(struct obex_session *os)
 {
-	char *path = g_strdup_printf("/transfer%u", os->cid);
+	const char *path = transfer_path(os);
+
+	cancel_authorization(os);
 
 	/* Got an error during a transfer. */
 	if (os->object)
-		emit_transfer_completed(os->cid, os->offset == os->size);
+		emit_transfer_completed(os, os->offset == os->size);
 
 	g_dbus_unregister_interface(connection, path,
 				TRANSFER_INTERFACE);
-
-	g_free(path);
 }
 
 static void agent_cancel()
@@ -458,31 +550,54 @@ static void agent_cancel()
 	g_dbus_send_message(connection, msg);
 }
 
+static gboolean resume_authorization(void *user_data)
+{
+	struct auth_request *req = user_data;
+
+	/* The session may pick up the result and free the request. A
+	 * session in a worker thread may not have installed its watch
+	 * yet, it is then woken up once it does. */
+	req->resume = 0;
+	obex_object_wakeup(req->os, G_IO_OUT, 0);
+
+	return FALSE;
+}
+
+static void auth_request_done(struct auth_request *req, int err)
+{
+	if (req->watch > 0) {
+		g_source_remove(req->watch);
+		req->watch = 0;
+	}
+
+	if (req->call) {
+		dbus_pending_call_unref(req->call);
+		req->call = NULL;
+	}
+
+	req->done = TRUE;
+	req->err = err;
+	req->resume = g_idle_add(resume_authorization, req);
+}
+
 static void agent_reply(DBusPendingCall *call, void *user_data)
 {
 	DBusMessage *reply = dbus_pending_call_steal_reply(call);
+	struct auth_request *req = user_data;
 	const char *name;
 	DBusError derr;
-	gboolean *got_reply = user_data;
-
-	*got_reply = TRUE;
-
-	/* Received a reply after the agent exited */
-	if (!agent)
-		return;
-
-	agent->auth_pending = FALSE;
 
 	dbus_error_init(&derr);
 	if (dbus_set_error_from_message(&derr, reply)) {
 		error("Agent replied with an error: %s, %s",
 				derr.name, derr.message);
 
-		if (dbus_error_has_name(&derr, DBUS_ERROR_NO_REPLY))
+		if (agent && dbus_error_has_name(&derr, DBUS_ERROR_NO_REPLY))
 			agent_cancel();
 
 		dbus_error_free(&derr);
 		dbus_message_unref(reply);
+		auth_request_done(req, -EPERM);
 		return;
 	}
 
@@ -493,27 +608,40 @@ static void agent_reply(DBusPendingCall *call, void *user_data)
 		const char *slash = strrchr(name, '/');
 		DBG("Agent replied with %s", name);
 		if (!slash) {
-			agent->new_name = g_strdup(name);
-			agent->new_folder = NULL;
+			req->new_name = g_strdup(name);
+			req->new_folder = NULL;
 		} else {
-			agent->new_name = g_strdup(slash + 1);
-			agent->new_folder = g_strndup(name, slash - name);
+			req->new_name = g_strdup(slash + 1);
+			req->new_folder = g_strndup(name, slash - name);
 		}
 	}
 
 	dbus_message_unref(reply);
+
+	auth_request_done(req, req->new_name ? 0 : -EPERM);
 }
 
 static gboolean auth_error(GIOChannel *io, GIOCondition cond, void *user_data)
 {
-	agent->auth_pending = FALSE;
+	struct auth_request *req = user_data;
+
+	req->watch = 0;
+
+	dbus_pending_call_cancel(req->call);
+	if (agent)
+		agent_cancel();
+
+	auth_request_done(req, -EPERM);
 
 	return FALSE;
 }
 
-int manager_request_authorization(struct obex_session *os, int32_t time,
+/* Returns -EAGAIN while the agent has not replied, the session is woken
+ * up through its io watch and is expected to call again for the result */
+static int request_authorization(struct obex_session *os, int32_t time,
 					char **new_folder, char **new_name)
 {
+	struct auth_request *req;
 	DBusMessage *msg;
 	DBusPendingCall *call;
 	GIOChannel *io;
@@ -523,19 +651,33 @@ int manager_request_authorization(struct obex_session *os, int32_t time,
 	const char *bda = address;
 	const char *filename = os->name ? os->name : "";
 	const char *type = os->type ? os->type : "";
-	char *path;
-	unsigned int watch, fd;
-	gboolean got_reply;
-
-	if (!agent)
-		return -1;
-
-	if (agent->auth_pending)
-		return -EPERM;
+	const char *path;
+	unsigned int fd;
+	int err;
 
 	if (!new_folder || !new_name)
 		return -EINVAL;
 
+	path = transfer_path(os);
+
+	req = g_hash_table_lookup(auth_requests, path);
+	if (req) {
+		if (!req->done)
+			return -EAGAIN;
+
+		err = req->err;
+		*new_folder = req->new_folder;
+		*new_name = req->new_name;
+		req->new_folder = NULL;
+		req->new_name = NULL;
+		g_hash_table_remove(auth_requests, path);
+
+		return err;
+	}
+
+	if (!agent)
+		return -1;
+
 	memset(&addr, 0, sizeof(addr));
 	addrlen = sizeof(addr);
 
@@ -545,8 +687,6 @@ int manager_request_authorization(struct obex_session *os, int32_t time,
 
 	ba2str(&addr.rc_bdaddr, address);
 
-	path = g_strdup_printf("/transfer%d", os->cid);
-
 	msg = dbus_message_new_method_call(agent->bus_name, agent->path,
 					"org.openobex.Agent", "Authorize");
 
@@ -559,8 +699,6 @@ int manager_request_authorization(struct obex_session *os, int32_t time,
 			DBUS_TYPE_INT32, &time,
 			DBUS_TYPE_INVALID);
 
-	g_free(path);
-
 	if (!dbus_connection_send_with_reply(connection,
 					msg, &call, TIMEOUT)) {
 		dbus_message_unref(msg);
@@ -569,43 +707,46 @@ int manager_request_authorization(struct obex_session *os, int32_t time,
 
 	dbus_message_unref(msg);
 
-	agent->auth_pending = TRUE;
-	got_reply = FALSE;
+	req = g_new0(struct auth_request, 1);
+	req->os = os;
+	req->call = call;
 
 	/* Catches errors before authorization response comes */
 	io = g_io_channel_unix_new(fd);
-	watch = g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
+	req->watch = g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
 			G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-			auth_error, NULL, NULL);
+			auth_error, req, NULL);
 	g_io_channel_unref(io);
 
-	dbus_pending_call_set_notify(call, agent_reply, &got_reply, NULL);
+	dbus_pending_call_set_notify(call, agent_reply, req, NULL);
 
-	/* Workaround: process events while agent doesn't reply */
-	while (agent && agent->auth_pending)
-		g_main_context_iteration(NULL, TRUE);
+	g_hash_table_insert(auth_requests, g_strdup(path), req);
 
-	g_source_remove(watch);
+	return -EAGAIN;
+}
 
-	if (!got_reply) {
-		dbus_pending_call_cancel(call);
-		agent_cancel();
-	}
+static gboolean request_authorization_cb(void *user_data)
+{
+	struct auth_call *call = user_data;
 
-	dbus_pending_call_unref(call);
+	call->ret = request_authorization(call->os, call->time,
+					call->new_folder, call->new_name);
 
-	if (!agent || !agent->new_name)
-		return -EPERM;
+	return FALSE;
+}
+
+int manager_request_authorization(struct obex_session *os, int32_t time,
+					char **new_folder, char **new_name)
+{
+	struct auth_call call = { os, time, new_folder, new_name, 0 };
 
-	*new_folder = agent->new_folder;
-	*new_name = agent->new_name;
-	agent->new_folder = NULL;
-	agent->new_name = NULL;
+	if (!obex_worker_call_main(request_authorization_cb, &call))
+		return -EPERM;
 
-	return 0;
+	return call.ret;
 }
 
-void manager_register_session(struct obex_session *os)
+static void register_session(struct obex_session *os)
 {
 	char *path = g_strdup_printf("/session%u", os->cid);
 
@@ -626,7 +767,7 @@ void manager_register_session(struct obex_session *os)
 	g_free(path);
 }
 
-void manager_unregister_session(struct obex_session *os)
+static void unregister_session(struct obex_session *os)
 {
 	char *path = g_strdup_printf("/session%u", os->cid);
 
@@ -641,15 +782,77 @@ void manager_unregister_session(struct obex_session *os)
 	g_free(path);
 }
 
+static void transfer_completed(struct obex_session *os)
+{
+	cancel_authorization(os);
+
+	if (os->object)
+		emit_transfer_completed(os, !os->aborted);
+}
+
+/* OBEX reports progress for every packet, only signal it once enough
+ * time has passed or enough data went through since the last signal */
+static gboolean transfer_progress_due(struct obex_session *os)
+{
+	unsigned int interval = obex_option_progress_interval();
+	unsigned int bytes = obex_option_progress_bytes();
+
+	if (os->offset == os->progress_offset)
+		return FALSE;
+
+	if ((interval == 0 && bytes == 0) || os->offset == os->size)
+		return TRUE;
+
+	if (bytes > 0 && os->offset - os->progress_offset >= bytes)
+		return TRUE;
+
+	if (interval == 0)
+		return FALSE;
+
+	if (os->progress_timer == NULL) {
+		os->progress_timer = g_timer_new();
+		return TRUE;
+	}
+
+	return g_timer_elapsed(os->progress_timer, NULL) * 1000 >= interval;
+}
+
+void manager_register_session(struct obex_session *os)
+{
+	call_in_main(register_session, os);
+}
+
+void manager_unregister_session(struct obex_session *os)
+{
+	call_in_main(unregister_session, os);
+}
+
+void manager_register_transfer(struct obex_session *os)
+{
+	call_in_main(register_transfer, os);
+}
+
+void manager_unregister_transfer(struct obex_session *os)
+{
+	call_in_main(unregister_transfer, os);
+}
+
+void manager_emit_transfer_started(struct obex_session *os)
+{
+	call_in_main(emit_transfer_started, os);
+}
+
 void manager_emit_transfer_progress(struct obex_session *os)
 {
-	emit_transfer_progress(os->cid, os->size, os->offset);
+	if (!transfer_progress_due(os))
+		return;
+
+	call_in_main(emit_transfer_progress, os);
 }
 
 void manager_emit_transfer_completed(struct obex_session *os)
 {
-	if (os->object)
-		emit_transfer_completed(os->cid, !os->aborted);
+	call_in_main(transfer_completed, os);
 }
 
 DBusConnection *obex_dbus_get_connection(void)
@@ -36,9 +36,17 @@
 #include "obex.h"
 #include "mimetype.h"
 
-static GSList *drivers = NULL;
+/* Drivers are indexed by their (target, who, mimetype) tuple */
+static GHashTable *drivers = NULL;
 
-static GSList *watches = NULL;
+/* Watches are indexed by object, wakeups must not scale with the number
+ * of suspended transfers */
+static GHashTable *watches = NULL;
+G_LOCK_DEFINE_STATIC(watches);
+
+/* Wakeups that came before the object had a watch, also protected by
+ * the watches lock */
+static GHashTable *pending = NULL;
 
 struct io_watch {
 	void *object;
@@ -46,77 +54,206 @@ struct io_watch {
 	void *user_data;
 };
 
-void obex_object_set_io_flags(void *object, int flags, int err)
+struct io_pending {
+	void *object;
+	int flags;
+	int err;
+};
+
+static struct io_watch *find_io_watch(void *object)
 {
-	GSList *l;
+	if (watches == NULL)
+		return NULL;
 
-	for (l = watches; l;) {
-		struct io_watch *watch = l->data;
+	return g_hash_table_lookup(watches, object);
+}
 
-		l = l->next;
+static void add_io_watch(struct io_watch *watch)
+{
+	if (watches == NULL)
+		watches = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+								NULL, g_free);
 
-		if (watch->object != object)
-			continue;
+	g_hash_table_insert(watches, watch->object, watch);
+}
 
-		if (watch->func(object, flags, err, watch->user_data) == TRUE)
-			continue;
+gboolean obex_object_set_io_flags(void *object, int flags, int err)
+{
+	struct io_watch *watch;
 
-		if (g_slist_find(watches, watch) == NULL)
-			continue;
+	G_LOCK(watches);
+	watch = find_io_watch(object);
+	if (watch)
+		g_hash_table_steal(watches, object);
+	G_UNLOCK(watches);
 
-		watches = g_slist_remove(watches, watch);
-		g_free(watch);
+	if (watch == NULL)
+		return FALSE;
+
+	/* The lock is not held here: backends may signal from any thread
+	 * and the callback may register a new watch for the object */
+	if (watch->func(object, flags, err, watch->user_data) == TRUE) {
+		G_LOCK(watches);
+		if (find_io_watch(object) == NULL) {
+			add_io_watch(watch);
+			watch = NULL;
+		}
+		G_UNLOCK(watches);
 	}
+
+	g_free(watch);
+
+	return TRUE;
 }
 
-static struct io_watch *find_io_watch(void *object)
+static gboolean deliver_pending(void *user_data)
 {
-	GSList *l;
+	struct io_pending *io = user_data;
 
-	for (l = watches; l; l = l->next) {
-		struct io_watch *watch = l->data;
+	obex_object_set_io_flags(io->object, io->flags, io->err);
 
-		if (watch->object == object)
-			return watch;
-	}
+	return FALSE;
+}
+
+/* Called with the watches lock held */
+static struct io_pending *steal_pending(void *object)
+{
+	struct io_pending *io;
+
+	if (pending == NULL)
+		return NULL;
 
-	return NULL;
+	io = g_hash_table_lookup(pending, object);
+	if (io)
+		g_hash_table_steal(pending, object);
+
+	return io;
 }
 
-static void reset_io_watch(void *object)
+static void schedule_pending(struct io_pending *io)
 {
-	struct io_watch *watch;
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, deliver_pending, io, g_free);
+}
 
-	watch = find_io_watch(object);
-	if (watch == NULL)
+void obex_object_wakeup(void *object, int flags, int err)
+{
+	struct io_pending *io;
+
+	if (obex_object_set_io_flags(object, flags, err))
 		return;
 
-	watches = g_slist_remove(watches, watch);
-	g_free(watch);
+	G_LOCK(watches);
+
+	if (pending == NULL)
+		pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+								NULL, g_free);
+
+	io = steal_pending(object);
+	if (io == NULL) {
+		io = g_new0(struct io_pending, 1);
+		io->object = object;
+	}
+
+	io->flags |= flags;
+	if (err < 0)
+		io->err = err;
+
+	/* The watch may have been installed since it was looked up */
+	if (find_io_watch(object))
+		schedule_pending(io);
+	else
+		g_hash_table_insert(pending, object, io);
+
+	G_UNLOCK(watches);
 }
 
 static int set_io_watch(void *object, obex_object_io_func func,
 				void *user_data)
 {
 	struct io_watch *watch;
+	struct io_pending *io;
+	int err = 0;
+
+	G_LOCK(watches);
 
 	if (func == NULL) {
-		reset_io_watch(object);
-		return 0;
+		if (watches)
+			g_hash_table_remove(watches, object);
+		g_free(steal_pending(object));
+		goto done;
 	}
 
 	watch = find_io_watch(object);
-	if (watch)
-		return -EPERM;
+	if (watch) {
+		err = -EPERM;
+		goto done;
+	}
 
 	watch = g_new0(struct io_watch, 1);
 	watch->object = object;
 	watch->func = func;
 	watch->user_data = user_data;
 
-	watches = g_slist_append(watches, watch);
+	add_io_watch(watch);
 
-	return 0;
+	/* Delivered from the main loop, the caller is still setting up */
+	io = steal_pending(object);
+	if (io)
+		schedule_pending(io);
+
+done:
+	G_UNLOCK(watches);
+
+	return err;
+}
+
+int obex_object_set_io_watch(void *object, obex_object_io_func func,
+				void *user_data)
+{
+	return set_io_watch(object, func, user_data);
+}
+
+void obex_object_release(void *object)
+{
+	set_io_watch(object, NULL, NULL);
+}
+
+static guint hash_bytes(guint h, const uint8_t *data, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; data && i < size; i++)
+		h = (h << 5) + h + data[i];
+
+	return (h << 5) + h + size;
+}
+
+static guint driver_hash(const void *key)
+{
+	const struct obex_mime_type_driver *driver = key;
+	guint h = 5381;
+
+	h = hash_bytes(h, driver->target, driver->target_size);
+	h = hash_bytes(h, driver->who, driver->who_size);
+
+	if (driver->mimetype)
+		h ^= g_str_hash(driver->mimetype);
+
+	return h;
+}
+
+static gboolean driver_equal(const void *a, const void *b)
+{
+	const struct obex_mime_type_driver *da = a, *db = b;
+
+	if (memncmp0(da->target, da->target_size, db->target,
+							db->target_size))
+		return FALSE;
+
+	if (memncmp0(da->who, da->who_size, db->who, db->who_size))
+		return FALSE;
+
+	return g_strcmp0(da->mimetype, db->mimetype) == 0;
 }
 
 static struct obex_mime_type_driver *find_driver(const uint8_t *target,
@@ -124,22 +261,19 @@ static struct obex_mime_type_driver *find_driver(const uint8_t *target,
 				const char *mimetype, const uint8_t *who,
 				unsigned int who_size)
 {
-	GSList *l;
+	struct obex_mime_type_driver key;
 
-	for (l = drivers; l; l = l->next) {
-		struct obex_mime_type_driver *driver = l->data;
+	if (drivers == NULL)
+		return NULL;
 
-		if (memncmp0(target, target_size, driver->target, driver->target_size))
-			continue;
+	memset(&key, 0, sizeof(key));
+	key.target = target;
+	key.target_size = target_size;
+	key.mimetype = mimetype;
+	key.who = who;
+	key.who_size = who_size;
 
-		if (memncmp0(who, who_size, driver->who, driver->who_size))
-			continue;
-
-		if (g_strcmp0(mimetype, driver->mimetype) == 0)
-			return driver;
-	}
-
-	return NULL;
+	return g_hash_table_lookup(drivers, &key);
 }
 
 struct obex_mime_type_driver *obex_mime_type_driver_find(const uint8_t *target,
@@ -189,19 +323,23 @@ int obex_mime_type_driver_register(struct obex_mime_type_driver *driver)
 
 	DBG("driver %p mimetype %s registered", driver, driver->mimetype);
 
-	drivers = g_slist_append(drivers, driver);
+	if (drivers == NULL)
+		drivers = g_hash_table_new(driver_hash, driver_equal);
+
+	g_hash_table_insert(drivers, driver, driver);
 
 	return 0;
 }
 
 void obex_mime_type_driver_unregister(struct obex_mime_type_driver *driver)
 {
-	if (!g_slist_find(drivers, driver)) {
+	if (drivers == NULL ||
+			g_hash_table_lookup(drivers, driver) != driver) {
 		error("Unable to unregister: No such driver %p", driver);
 		return;
 	}
 
 	DBG("driver %p mimetype %s unregistered", driver, driver->mimetype);
 
-	drivers = g_slist_remove(drivers, driver);
+	g_hash_table_remove(drivers, driver);
 }
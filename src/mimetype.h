@@ -35,8 +35,23 @@ struct obex_mime_type_driver {
 	int (*close) (void *object);
 	ssize_t (*read) (void *object, void *buf, size_t count, uint8_t *hi,
 							unsigned int *flags);
+	/* Optional: points buf to the object data instead of copying it,
+	 * valid until the next call. -ENOSYS falls back to read. */
+	ssize_t (*map) (void *object, const void **buf, size_t count,
+					uint8_t *hi, unsigned int *flags);
 	ssize_t (*write) (void *object, const void *buf, size_t count);
+	/* Optional: called once all the data of a PUT has been written,
+	 * before it is answered. -EAGAIN waits for the io watch, any other
+	 * error fails the transfer. */
+	int (*flush) (void *object);
 	int (*remove) (const char *name);
+	/* May return -EAGAIN and finish in the background, the result is
+	 * then delivered to the io watch of object */
+	int (*copy) (const char *name, const char *destname, void *object);
+	/* Optional: stops what was started in the background for object,
+	 * nothing is delivered to it anymore */
+	void (*cancel) (void *object);
+	int (*rename) (const char *name, const char *destname);
 	int (*set_io_watch) (void *object, obex_object_io_func func,
 				void *user_data);
 };
@@ -48,4 +63,11 @@ struct obex_mime_type_driver *obex_mime_type_driver_find(const uint8_t *target,
 				const char *mimetype, const uint8_t *who,
 				unsigned int who_size);
 
-void obex_object_set_io_flags(void *object, int flags, int err);
+gboolean obex_object_set_io_flags(void *object, int flags, int err);
+/* Same as obex_object_set_io_flags, but if the object has no watch yet the
+ * flags are kept and delivered once, as soon as the watch is installed */
+void obex_object_wakeup(void *object, int flags, int err);
+int obex_object_set_io_watch(void *object, obex_object_io_func func,
+				void *user_data);
+/* Drops the watch and any undelivered wakeup of an object being freed */
+void obex_object_release(void *object);
@@ -31,8 +31,14 @@ struct obex_session {
 	char *name;
 	char *type;
 	char *path;
+	char *destname;
+	int action_id;
+	uint32_t permissions;
 	time_t time;
 	uint8_t *buf;
+	uint8_t *spill;
+	size_t spill_size;
+	size_t spill_offset;
 	int64_t pending;
 	int64_t offset;
 	int64_t size;
@@ -42,12 +48,25 @@ struct obex_session {
 	void *service_data;
 	struct obex_server *server;
 	gboolean checked;
+	gboolean flushing;
 	obex_t *obex;
 	obex_object_t *obj;
 	struct obex_mime_type_driver *driver;
 	gboolean finished;
 	uint16_t write_offset;
+	GMainContext *context;
+	GSource *source;
+	GSource *async;
+	int async_flags;
+	int async_err;
+	unsigned int wakeups;
+	unsigned int packets;
+	unsigned int max_packets;
+	char *transfer_path;
+	GTimer *progress_timer;
+	int64_t progress_offset;
 };
 
 int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 			struct obex_server *server);
+void obex_session_destroy_all(GMainContext *context);
@@ -50,12 +50,24 @@
 #include "mimetype.h"
 #include "service.h"
 #include "transport.h"
+#include "worker.h"
 #include "btio.h"
 
 /* Default MTU's */
 #define DEFAULT_RX_MTU 32767
 #define DEFAULT_TX_MTU 32767
 
+/* Maximum OBEX_HandleInput calls per session and main loop wakeup */
+#define INPUT_BUDGET 16
+
+/* Single Response Mode headers (OBEX 1.4) */
+#ifndef OBEX_HDR_SRM
+#define OBEX_HDR_SRM 0x97
+#endif
+#ifndef OBEX_HDR_SRM_PARAMETERS
+#define OBEX_HDR_SRM_PARAMETERS 0x98
+#endif
+
 /* Challenge request */
 #define NONCE_TAG 0x00
 #define OPTIONS_TAG 0x01 /* Optional */
@@ -72,6 +84,7 @@
 static uint32_t cid = 0x0000;
 
 static GSList *sessions = NULL;
+G_LOCK_DEFINE_STATIC(sessions);
 
 typedef struct {
 	uint8_t  version;
@@ -126,6 +139,7 @@ static struct {
 	{ OBEX_CMD_PUT,		"PUT"		},
 	{ OBEX_CMD_GET,		"GET"		},
 	{ OBEX_CMD_SETPATH,	"SETPATH"	},
+	{ OBEX_CMD_ACTION,	"ACTION"	},
 	{ OBEX_CMD_SESSION,	"SESSION"	},
 	{ OBEX_CMD_ABORT,	"ABORT"		},
 	{ OBEX_FINAL,		"FINAL"		},
@@ -278,6 +292,12 @@ static void os_reset_session(struct obex_session *os)
 	if (os->service && os->service->reset)
 		os->service->reset(os, os->service_data);
 
+	/* e.g. an aborted copy, its result must not reach the next request */
+	if (os->driver && os->driver->cancel)
+		os->driver->cancel(os);
+
+	obex_object_set_io_watch(os, NULL, NULL);
+
 	if (os->object) {
 		os->driver->set_io_watch(os->object, NULL, NULL);
 		os->driver->close(os->object);
@@ -304,10 +324,20 @@ static void os_reset_session(struct obex_session *os)
 		g_free(os->path);
 		os->path = NULL;
 	}
+	if (os->destname) {
+		g_free(os->destname);
+		os->destname = NULL;
+	}
+
+	if (os->spill_size > os->rx_mtu) {
+		os->spill_size = os->rx_mtu;
+		os->spill = g_realloc(os->spill, os->spill_size);
+	}
 
 	os->driver = NULL;
 	os->aborted = FALSE;
 	os->pending = 0;
+	os->spill_offset = 0;
 	os->offset = 0;
 	os->size = OBJECT_SIZE_DELETE;
 	os->finished = 0;
@@ -315,11 +345,20 @@ static void os_reset_session(struct obex_session *os)
 
 static void obex_session_free(struct obex_session *os)
 {
+	G_LOCK(sessions);
 	sessions = g_slist_remove(sessions, os);
+	G_UNLOCK(sessions);
+
+	obex_object_release(os);
 
 	if (os->io)
 		g_io_channel_unref(os->io);
 
+	if (os->progress_timer)
+		g_timer_destroy(os->progress_timer);
+
+	g_free(os->transfer_path);
+	g_free(os->spill);
 	g_free(os);
 }
 
@@ -448,7 +487,7 @@ static void cmd_connect(struct obex_session *os,
 	DBG("Resizing stream chunks to %d", newsize);
 
 	/* connection id will be used to track the sessions, even for OPP */
-	os->cid = ++cid;
+	os->cid = g_atomic_int_exchange_and_add((volatile gint *) &cid, 1) + 1;
 
 	while (OBEX_ObjectGetNextHeader(obex, obj, &hi, &hd, &hlen)) {
 		switch (hi) {
@@ -549,11 +588,71 @@ static gboolean chk_cid(obex_t *obex, obex_object_t *obj, uint32_t cid)
 	return ret;
 }
 
+static void spill_data(struct obex_session *os, const uint8_t *data,
+								size_t size)
+{
+	size_t end = os->spill_offset + os->pending;
+
+	if (end + size > os->spill_size) {
+		memmove(os->spill, os->spill + os->spill_offset, os->pending);
+		os->spill_offset = 0;
+		end = os->pending;
+	}
+
+	/* Only grows while data arrives before the object is open */
+	if (end + size > os->spill_size) {
+		os->spill_size = end + size;
+		os->spill = g_realloc(os->spill, os->spill_size);
+	}
+
+	memcpy(os->spill + end, data, size);
+	os->pending += size;
+}
+
+static int write_data(struct obex_session *os, const uint8_t *data,
+						size_t size, size_t *written)
+{
+	size_t len = 0;
+
+	while (len < size) {
+		ssize_t w;
+
+		w = os->driver->write(os->object, data + len, size - len);
+		if (w < 0) {
+			if (w == -EINTR)
+				continue;
+
+			*written = len;
+			return w;
+		}
+
+		len += w;
+		os->offset += w;
+	}
+
+	*written = len;
+
+	return 0;
+}
+
+static int flush_spill(struct obex_session *os)
+{
+	size_t len;
+	int err;
+
+	err = write_data(os, os->spill + os->spill_offset, os->pending, &len);
+
+	os->pending -= len;
+	os->spill_offset = os->pending > 0 ? os->spill_offset + len : 0;
+
+	return err;
+}
+
 static int obex_read_stream(struct obex_session *os, obex_t *obex,
 						obex_object_t *obj)
 {
-	int size;
-	ssize_t len = 0;
+	int size, err;
+	size_t len;
 	const uint8_t *buffer;
 
 	DBG("name=%s type=%s rx_mtu=%d file=%p",
@@ -568,8 +667,8 @@ static int obex_read_stream(struct obex_session *os, obex_t *obex,
 		os->size = OBJECT_SIZE_UNKNOWN;
 
 	/* If there's something to write and we are able to write it */
-	if (os->pending > 0 && os->driver)
-		goto write;
+	if (os->pending > 0 && os->object && os->driver)
+		return flush_spill(os);
 
 	size = OBEX_ObjectReadStream(obex, obj, &buffer);
 	if (size < 0) {
@@ -582,45 +681,27 @@ static int obex_read_stream(struct obex_session *os, obex_t *obex,
 		return -EIO;
 	}
 
-	os->buf = g_realloc(os->buf, os->pending + size);
-	memcpy(os->buf + os->pending, buffer, size);
-	os->pending += size;
-
 	/* only write if both object and driver are valid */
 	if (os->object == NULL || os->driver == NULL) {
+		spill_data(os, buffer, size);
 		DBG("Stored %" PRIu64 " bytes into temporary buffer",
 								os->pending);
 		return 0;
 	}
 
-write:
-	while (os->pending > 0) {
-		ssize_t w;
-
-		w = os->driver->write(os->object, os->buf + len,
-					os->pending);
-		if (w < 0) {
-			if (w == -EINTR)
-				continue;
-			else {
-				memmove(os->buf, os->buf + len, os->pending);
-				return w;
-			}
-		}
-
-		len += w;
-		os->offset += w;
-		os->pending -= w;
-	}
+	/* Write straight from the OpenOBEX buffer, spill what is left over */
+	err = write_data(os, buffer, size, &len);
+	if (err < 0)
+		spill_data(os, buffer + len, size - len);
 
-	return 0;
+	return err;
 }
 
 static int obex_write_stream(struct obex_session *os,
 			obex_t *obex, obex_object_t *obj)
 {
 	obex_headerdata_t hd;
-	uint8_t *ptr;
+	const void *ptr;
 	ssize_t len;
 	unsigned int flags;
 	uint8_t hi;
@@ -642,9 +723,20 @@ static int obex_write_stream(struct obex_session *os,
 		goto add_header;
 	}
 
+	/* Body data straight from the driver, OpenOBEX does the only copy */
+	if (os->driver->map && os->write_offset == 0) {
+		len = os->driver->map(os->object, &ptr, os->tx_mtu, &hi,
+								&flags);
+		if (len != -ENOSYS)
+			goto check;
+	}
+
 	ptr = os->buf + os->write_offset;
-	len = os->driver->read(os->object, ptr, os->tx_mtu - os->write_offset,
-								&hi, &flags);
+	len = os->driver->read(os->object, os->buf + os->write_offset,
+					os->tx_mtu - os->write_offset,
+					&hi, &flags);
+
+check:
 	if (len < 0) {
 		error("read(): %s (%zd)", strerror(-len), -len);
 		if (len == -EAGAIN)
@@ -689,25 +781,116 @@ add_header:
 	return 0;
 }
 
+static gboolean handle_async_io(void *object, int flags, int err,
+						void *user_data);
+static gboolean check_put(obex_t *obex, obex_object_t *obj);
+static void put_complete(struct obex_session *os, obex_object_t *obj);
+
+/* Protects the wakeup a session gets from other threads, which may come
+ * again before it ran or race with the session being destroyed */
+G_LOCK_DEFINE_STATIC(async);
+
+static gboolean resume_async_io(void *user_data)
+{
+	struct obex_session *os = user_data;
+	int flags, err;
+
+	G_LOCK(async);
+	flags = os->async_flags;
+	err = os->async_err;
+	os->async = NULL;
+	os->async_flags = 0;
+	os->async_err = 0;
+	G_UNLOCK(async);
+
+	handle_async_io(os->object, flags, err, os);
+
+	return FALSE;
+}
+
 static gboolean handle_async_io(void *object, int flags, int err,
 						void *user_data)
 {
 	struct obex_session *os = user_data;
 	int ret = 0;
 
+	/* Sessions pinned to a worker are only resumed from its thread,
+	 * wakeups coming before it ran are merged into the pending one */
+	if (os->context && !g_main_context_is_owner(os->context)) {
+		G_LOCK(async);
+
+		os->async_flags |= flags;
+		if (err < 0 && os->async_err == 0)
+			os->async_err = err;
+
+		if (os->async == NULL) {
+			os->async = g_idle_source_new();
+			g_source_set_callback(os->async, resume_async_io, os,
+									NULL);
+			g_source_attach(os->async, os->context);
+			g_source_unref(os->async);
+		}
+
+		G_UNLOCK(async);
+
+		return FALSE;
+	}
+
+	/* An action finished in the background */
+	if (os->cmd == OBEX_CMD_ACTION) {
+		os_set_response(os->obj, err);
+		OBEX_ResumeRequest(os->obex);
+		return FALSE;
+	}
+
+	/* Waiting for the driver to write out the end of a PUT */
+	if (os->flushing) {
+		os->flushing = FALSE;
+
+		if (err < 0)
+			os_set_response(os->obj, err);
+		else
+			put_complete(os, os->obj);
+
+		if (!os->flushing)
+			OBEX_ResumeRequest(os->obex);
+
+		return FALSE;
+	}
+
 	if (err < 0) {
 		ret = err;
 		goto proceed;
 	}
 
+	/* The service asked to wait before accepting the PUT, check again */
+	if (os->cmd == OBEX_CMD_PUT && !os->checked) {
+		if (!check_put(os->obex, os->obj)) {
+			OBEX_CancelRequest(os->obex, TRUE);
+			return FALSE;
+		}
+
+		if (!os->checked)
+			return FALSE;
+
+		/* Spilled data is flushed by the next stream event */
+		goto proceed;
+	}
+
 	if (flags & (G_IO_IN | G_IO_PRI))
 		ret = obex_write_stream(os, os->obex, os->obj);
 	else if (flags & G_IO_OUT)
 		ret = obex_read_stream(os, os->obex, os->obj);
 
 proceed:
+	/* Still busy, e.g. spilled data only partly taken */
+	if (ret == -EAGAIN) {
+		os->driver->set_io_watch(os->object, handle_async_io, os);
+		return FALSE;
+	}
+
 	if (ret < 0) {
-		os_set_response(os->obj, err);
+		os_set_response(os->obj, ret);
 		OBEX_CancelRequest(os->obex, TRUE);
 	} else
 		OBEX_ResumeRequest(os->obex);
@@ -778,6 +961,12 @@ static void cmd_get(struct obex_session *os, obex_t *obex, obex_object_t *obj)
 						os->service->who,
 						os->service->who_size);
 			break;
+		case OBEX_HDR_SRM:
+			DBG("OBEX_HDR_SRM: 0x%02x", hd.bq1);
+			break;
+		case OBEX_HDR_SRM_PARAMETERS:
+			DBG("OBEX_HDR_SRMP: 0x%02x", hd.bq1);
+			break;
 		}
 	}
 
@@ -889,6 +1078,80 @@ static void cmd_setpath(struct obex_session *os,
 	os_set_response(obj, err);
 }
 
+static void cmd_action(struct obex_session *os, obex_t *obex,
+							obex_object_t *obj)
+{
+	obex_headerdata_t hd;
+	unsigned int hlen;
+	uint8_t hi;
+	int err;
+
+	if (!os->service) {
+		OBEX_ObjectSetRsp(obj, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
+		return;
+	} else if (!os->service->action) {
+		OBEX_ObjectSetRsp(obj, OBEX_RSP_NOT_IMPLEMENTED,
+				OBEX_RSP_NOT_IMPLEMENTED);
+		return;
+	}
+
+	g_return_if_fail(chk_cid(obex, obj, os->cid));
+
+	g_free(os->name);
+	os->name = NULL;
+	g_free(os->destname);
+	os->destname = NULL;
+	os->action_id = -1;
+	os->permissions = 0;
+
+	while (OBEX_ObjectGetNextHeader(obex, obj, &hi, &hd, &hlen)) {
+		switch (hi) {
+		case OBEX_HDR_NAME:
+			if (os->name || hlen == 0)
+				break;
+
+			os->name = g_convert((const char *) hd.bs, hlen,
+					"UTF8", "UTF16BE", NULL, NULL, NULL);
+			DBG("OBEX_HDR_NAME: %s", os->name);
+			break;
+		case OBEX_HDR_DESTNAME:
+			if (os->destname || hlen == 0)
+				break;
+
+			os->destname = g_convert((const char *) hd.bs, hlen,
+					"UTF8", "UTF16BE", NULL, NULL, NULL);
+			DBG("OBEX_HDR_DESTNAME: %s", os->destname);
+			break;
+		case OBEX_HDR_ACTION_ID:
+			os->action_id = hd.bq1;
+			DBG("OBEX_HDR_ACTION_ID: %u", hd.bq1);
+			break;
+		case OBEX_HDR_PERMISSIONS:
+			os->permissions = hd.bq4;
+			DBG("OBEX_HDR_PERMISSIONS: 0x%08x", hd.bq4);
+			break;
+		}
+	}
+
+	/* Copy and move go through the default driver of the service */
+	os->driver = obex_mime_type_driver_find(os->service->target,
+						os->service->target_size,
+						NULL,
+						os->service->who,
+						os->service->who_size);
+
+	err = os->service->action(os, obj, os->service_data);
+	if (err == -EAGAIN) {
+		/* Answered once the driver is done, e.g. with a copy */
+		OBEX_SuspendRequest(obex, obj);
+		os->obj = obj;
+		obex_object_set_io_watch(os, handle_async_io, os);
+		return;
+	}
+
+	os_set_response(obj, err);
+}
+
 int obex_get_stream_start(struct obex_session *os, const char *filename)
 {
 	int err;
@@ -927,14 +1190,11 @@ int obex_put_stream_start(struct obex_session *os, const char *filename)
 
 	os->path = g_strdup(filename);
 
-	if (!os->buf) {
+	if (os->pending == 0) {
 		DBG("PUT request checked, no buffered data");
 		return 0;
 	}
 
-	if (os->pending == 0)
-		return 0;
-
 	return obex_read_stream(os, os->obex, NULL);
 }
 
@@ -1014,6 +1274,12 @@ static gboolean check_put(obex_t *obex, obex_object_t *obj)
 		case OBEX_HDR_TIME:
 			os->time = parse_iso8610((const char *) hd.bs, hlen);
 			break;
+		case OBEX_HDR_SRM:
+			DBG("OBEX_HDR_SRM: 0x%02x", hd.bq1);
+			break;
+		case OBEX_HDR_SRM_PARAMETERS:
+			DBG("OBEX_HDR_SRMP: 0x%02x", hd.bq1);
+			break;
 		}
 	}
 
@@ -1050,7 +1316,13 @@ static gboolean check_put(obex_t *obex, obex_object_t *obj)
 	case -EAGAIN:
 		OBEX_SuspendRequest(obex, obj);
 		os->obj = obj;
-		os->driver->set_io_watch(os->object, handle_async_io, os);
+		/* Nothing is open yet when waiting for e.g. the agent to
+		 * authorize the transfer, it wakes up the session itself */
+		if (os->object == NULL)
+			obex_object_set_io_watch(os, handle_async_io, os);
+		else
+			os->driver->set_io_watch(os->object, handle_async_io,
+									os);
 		return TRUE;
 	default:
 		DBG("Unhandled chkput error: %d", ret);
@@ -1071,20 +1343,38 @@ done:
 	return TRUE;
 }
 
-static void cmd_put(struct obex_session *os, obex_t *obex, obex_object_t *obj)
+/* Data left in the spill buffer or in the driver is written out before
+ * the PUT is answered, so that write errors still reach the client */
+static int put_flush(struct obex_session *os)
 {
 	int err;
 
-	if (!os->service) {
-		OBEX_ObjectSetRsp(obj, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
-		return;
+	if (os->pending > 0 && os->object) {
+		err = flush_spill(os);
+		if (err < 0)
+			return err;
 	}
 
-	g_return_if_fail(chk_cid(obex, obj, os->cid));
+	if (os->object == NULL || os->driver->flush == NULL)
+		return 0;
 
-	if (!os->checked) {
-		if (!check_put(obex, obj))
-			return;
+	return os->driver->flush(os->object);
+}
+
+static void put_complete(struct obex_session *os, obex_object_t *obj)
+{
+	int err;
+
+	err = put_flush(os);
+	if (err == -EAGAIN) {
+		OBEX_SuspendRequest(os->obex, obj);
+		os->obj = obj;
+		os->flushing = TRUE;
+		os->driver->set_io_watch(os->object, handle_async_io, os);
+		return;
+	} else if (err < 0) {
+		os_set_response(obj, err);
+		return;
 	}
 
 	if (!os->service->put) {
@@ -1098,6 +1388,28 @@ static void cmd_put(struct obex_session *os, obex_t *obex, obex_object_t *obj)
 		os_set_response(obj, err);
 }
 
+static void cmd_put(struct obex_session *os, obex_t *obex, obex_object_t *obj)
+{
+
+	if (!os->service) {
+		OBEX_ObjectSetRsp(obj, OBEX_RSP_FORBIDDEN, OBEX_RSP_FORBIDDEN);
+		return;
+	}
+
+	g_return_if_fail(chk_cid(obex, obj, os->cid));
+
+	if (!os->checked) {
+		if (!check_put(obex, obj))
+			return;
+
+		/* Suspended until the service is done checking */
+		if (!os->checked)
+			return;
+	}
+
+	put_complete(os, obj);
+}
+
 static void obex_event_cb(obex_t *obex, obex_object_t *obj, int mode,
 					int evt, int cmd, int rsp)
 {
@@ -1138,9 +1450,11 @@ static void obex_event_cb(obex_t *obex, obex_object_t *obj, int mode,
 		switch (cmd) {
 		case OBEX_CMD_PUT:
 			os->checked = FALSE;
+			os->flushing = FALSE;
 			OBEX_ObjectReadStream(obex, obj, NULL);
 		case OBEX_CMD_GET:
 		case OBEX_CMD_SETPATH:
+		case OBEX_CMD_ACTION:
 		case OBEX_CMD_CONNECT:
 		case OBEX_CMD_DISCONNECT:
 			OBEX_ObjectSetRsp(obj, OBEX_RSP_CONTINUE,
@@ -1172,6 +1486,9 @@ static void obex_event_cb(obex_t *obex, obex_object_t *obj, int mode,
 		case OBEX_CMD_SETPATH:
 			cmd_setpath(os, obex, obj);
 			break;
+		case OBEX_CMD_ACTION:
+			cmd_action(os, obex, obj);
+			break;
 		case OBEX_CMD_GET:
 			cmd_get(os, obex, obj);
 			break;
@@ -1229,6 +1546,16 @@ static void obex_handle_destroy(void *user_data)
 
 	os = OBEX_GetUserData(obex);
 
+	G_LOCK(async);
+	if (os->async) {
+		g_source_destroy(os->async);
+		os->async = NULL;
+	}
+	G_UNLOCK(async);
+
+	DBG("%u packets handled in %u wakeups (max %u per wakeup)",
+			os->packets, os->wakeups, os->max_packets);
+
 	os_reset_session(os);
 
 	if (os->service && os->service->disconnect)
@@ -1243,6 +1570,9 @@ static gboolean obex_handle_input(GIOChannel *io,
 				GIOCondition cond, void *user_data)
 {
 	obex_t *obex = user_data;
+	struct obex_session *os = OBEX_GetUserData(obex);
+	unsigned int count;
+	int ret, timeout;
 
 	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL)) {
 		error("obex_handle_input: poll event %s%s%s",
@@ -1252,11 +1582,26 @@ static gboolean obex_handle_input(GIOChannel *io,
 		return FALSE;
 	}
 
-	if (OBEX_HandleInput(obex, 1) < 0) {
-		error("Handle input error");
-		return FALSE;
+	/* Keep parsing while input is queued, but give other sessions a
+	 * chance once the budget is spent */
+	for (count = 0, timeout = 1; count < INPUT_BUDGET; count++) {
+		ret = OBEX_HandleInput(obex, timeout);
+		if (ret < 0) {
+			error("Handle input error");
+			return FALSE;
+		}
+
+		if (ret == 0)
+			break;
+
+		timeout = 0;
 	}
 
+	os->wakeups++;
+	os->packets += count;
+	if (count > os->max_packets)
+		os->max_packets = count;
+
 	return TRUE;
 }
 
@@ -1264,6 +1609,7 @@ int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 			struct obex_server *server)
 {
 	struct obex_session *os;
+	GSource *source;
 	obex_t *obex;
 	int ret, fd;
 
@@ -1276,6 +1622,10 @@ int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 	os->tx_mtu = tx_mtu != 0 ? tx_mtu : DEFAULT_TX_MTU;
 	os->size = OBJECT_SIZE_DELETE;
 
+	/* Leftovers of at most one packet are kept when a write is partial */
+	os->spill_size = os->rx_mtu;
+	os->spill = g_malloc(os->spill_size);
+
 	obex = OBEX_Init(OBEX_TRANS_FD, obex_event_cb, 0);
 	if (!obex) {
 		obex_session_free(os);
@@ -1287,6 +1637,12 @@ int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 
 	OBEX_SetTransportMTU(obex, os->rx_mtu, os->tx_mtu);
 
+#ifdef HAVE_OBEX_SRM
+	/* Body packets are streamed without a CONTINUE each once the
+	 * client enables SRM as well, otherwise nothing changes */
+	OBEX_SetReponseMode(obex, OBEX_RSP_MODE_SINGLE);
+#endif
+
 	fd = g_io_channel_unix_get_fd(io);
 
 	ret = FdOBEX_TransportSetup(obex, fd, fd, 0);
@@ -1296,16 +1652,60 @@ int obex_session_start(GIOChannel *io, uint16_t tx_mtu, uint16_t rx_mtu,
 		return ret;
 	}
 
-	g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
-			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-			obex_handle_input, obex, obex_handle_destroy);
 	os->io = g_io_channel_ref(io);
 
+	G_LOCK(sessions);
 	sessions = g_slist_prepend(sessions, os);
+	G_UNLOCK(sessions);
+
+	/* Other services keep running in the main loop */
+	if (server->threaded)
+		os->context = obex_worker_next_context();
+
+	if (os->context == NULL) {
+		g_io_add_watch_full(io, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				obex_handle_input, obex, obex_handle_destroy);
+		return 0;
+	}
+
+	/* From here on the session only runs in the worker thread */
+	source = g_io_create_watch(io,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL);
+	g_source_set_callback(source, (GSourceFunc) obex_handle_input, obex,
+							obex_handle_destroy);
+
+	/* Set first, the worker may run and free the session at once */
+	os->source = source;
+	g_source_attach(source, os->context);
+	g_source_unref(source);
 
 	return 0;
 }
 
+/* Called from the thread running context when it is about to stop */
+void obex_session_destroy_all(GMainContext *context)
+{
+	GSList *l, *stop = NULL;
+
+	G_LOCK(sessions);
+
+	for (l = sessions; l; l = l->next) {
+		struct obex_session *os = l->data;
+
+		if (os->context == context)
+			stop = g_slist_prepend(stop, os->source);
+	}
+
+	G_UNLOCK(sessions);
+
+	/* Destroying the transport watch tears the session down */
+	for (l = stop; l; l = l->next)
+		g_source_destroy(l->data);
+
+	g_slist_free(stop);
+}
+
 const char *obex_get_name(struct obex_session *os)
 {
 	return os->name;
@@ -1361,6 +1761,43 @@ int obex_remove(struct obex_session *os, const char *path)
 	return os->driver->remove(path);
 }
 
+int obex_copy(struct obex_session *os, const char *source,
+						const char *destination)
+{
+	if (os->driver == NULL || os->driver->copy == NULL)
+		return -EINVAL;
+
+	DBG("%s -> %s", source, destination);
+
+	return os->driver->copy(source, destination, os);
+}
+
+int obex_move(struct obex_session *os, const char *source,
+						const char *destination)
+{
+	if (os->driver == NULL || os->driver->rename == NULL)
+		return -EINVAL;
+
+	DBG("%s -> %s", source, destination);
+
+	return os->driver->rename(source, destination);
+}
+
+const char *obex_get_destname(struct obex_session *os)
+{
+	return os->destname;
+}
+
+int obex_get_action_id(struct obex_session *os)
+{
+	return os->action_id;
+}
+
+uint32_t obex_get_permissions(struct obex_session *os)
+{
+	return os->permissions;
+}
+
 /* TODO: find a way to do this for tty or fix syncevolution */
 char *obex_get_id(struct obex_session *os)
 {
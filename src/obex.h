@@ -39,6 +39,18 @@
 
 #define TARGET_SIZE 16
 
+#ifndef OBEX_CMD_ACTION
+#define OBEX_CMD_ACTION		0x06
+
+#define OBEX_HDR_ACTION_ID	0x94
+#define OBEX_HDR_DESTNAME	0x15
+#define OBEX_HDR_PERMISSIONS	0xD6
+#endif
+
+#define OBEX_ACTION_COPY	0x00
+#define OBEX_ACTION_MOVE	0x01
+#define OBEX_ACTION_SETPERM	0x02
+
 struct obex_session;
 
 void obex_connect_cb(GIOChannel *io, GError *err, void *user_data);
@@ -55,14 +67,33 @@ gboolean obex_get_symlinks(struct obex_session *os);
 const char *obex_get_capability_path(struct obex_session *os);
 gboolean obex_get_auto_accept(struct obex_session *os);
 int obex_remove(struct obex_session *os, const char *path);
+int obex_copy(struct obex_session *os, const char *source,
+						const char *destination);
+int obex_move(struct obex_session *os, const char *source,
+						const char *destination);
+const char *obex_get_destname(struct obex_session *os);
+int obex_get_action_id(struct obex_session *os);
+uint32_t obex_get_permissions(struct obex_session *os);
 char *obex_get_id(struct obex_session *os);
 ssize_t obex_aparam_read(struct obex_session *os, obex_object_t *obj,
 						const uint8_t **buffer);
 int obex_aparam_write(struct obex_session *os, obex_object_t *obj,
 				const uint8_t *buffer, unsigned int size);
 
+/* When data of received files is synced to disk */
+enum obex_durability {
+	OBEX_DURABILITY_NONE,
+	OBEX_DURABILITY_END,
+	OBEX_DURABILITY_PERIODIC,
+};
+
 const char *obex_option_root_folder(void);
 gboolean obex_option_symlinks(void);
+gboolean obex_option_async_io(void);
+gboolean obex_option_content_index(void);
+enum obex_durability obex_option_durability(void);
+unsigned int obex_option_progress_interval(void);
+unsigned int obex_option_progress_bytes(void);
 
 /* Just a thin wrapper around memcmp to deal with NULL values */
 int memncmp0(const void *a, size_t na, const void *b, size_t nb);
@@ -62,6 +62,7 @@ int obex_server_init(uint16_t service, const char *folder,
 	GSList *drivers;
 	GSList *transports;
 	GSList *l;
+	gboolean threaded = TRUE;
 
 	drivers = obex_service_driver_list(service);
 	if (drivers == NULL) {
@@ -69,6 +70,14 @@ int obex_server_init(uint16_t service, const char *folder,
 		return -EINVAL;
 	}
 
+	/* Any of the drivers may end up handling a connection */
+	for (l = drivers; l; l = l->next) {
+		struct obex_service_driver *driver = l->data;
+
+		if (!driver->threaded)
+			threaded = FALSE;
+	}
+
 	transports = obex_transport_driver_list();
 	if (transports == NULL) {
 		DBG("No transport driver registered");
@@ -87,6 +96,7 @@ int obex_server_init(uint16_t service, const char *folder,
 		server = g_new0(struct obex_server, 1);
 		server->transport = transport;
 		server->drivers = drivers;
+		server->threaded = threaded;
 		server->folder = g_strdup(folder);
 		server->auto_accept = auto_accept;
 		server->symlinks = symlinks;
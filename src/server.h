@@ -33,6 +33,7 @@ struct obex_server {
 	GIOChannel *io;
 	unsigned int watch;
 	GSList *drivers;
+	gboolean threaded;
 };
 
 int obex_server_init(uint16_t service, const char *folder, gboolean secure,
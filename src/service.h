@@ -30,6 +30,10 @@ struct obex_service_driver {
 	const uint8_t *who;
 	unsigned int who_size;
 	const char *record;
+	/* Sessions may run in a worker thread: the driver and the mime
+	 * drivers it uses keep no unprotected state and leave D-Bus to
+	 * the manager */
+	gboolean threaded;
 	void *(*connect) (struct obex_session *os, int *err);
 	void (*progress) (struct obex_session *os, void *user_data);
 	int (*get) (struct obex_session *os, obex_object_t *obj,
@@ -39,6 +43,8 @@ struct obex_service_driver {
 	int (*chkput) (struct obex_session *os, void *user_data);
 	int (*setpath) (struct obex_session *os, obex_object_t *obj,
 							void *user_data);
+	int (*action) (struct obex_session *os, obex_object_t *obj,
+							void *user_data);
 	void (*disconnect) (struct obex_session *os, void *user_data);
 	void (*reset) (struct obex_session *os, void *user_data);
 };
@@ -0,0 +1,251 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <glib.h>
+
+#include <openobex/obex.h>
+#include <openobex/obex_const.h>
+
+#include "log.h"
+#include "obex.h"
+#include "obex-priv.h"
+#include "worker.h"
+
+struct obex_worker {
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+};
+
+struct main_call {
+	GSourceFunc func;
+	void *data;
+	guint id;
+	gboolean done;
+	gboolean failed;
+};
+
+static struct obex_worker *workers = NULL;
+static unsigned int workers_count = 0;
+static volatile int next_worker = 0;
+
+static GThread *main_thread = NULL;
+static GMutex *call_mutex = NULL;
+static GCond *call_cond = NULL;
+
+/* Calls waiting for the main loop and whether it still runs them, both
+ * protected by call_mutex */
+static GSList *calls = NULL;
+static gboolean exiting = FALSE;
+
+static void *worker_run(void *data)
+{
+	struct obex_worker *worker = data;
+
+	DBG("worker %p running", worker);
+
+	g_main_loop_run(worker->loop);
+
+	return NULL;
+}
+
+int obex_worker_init(unsigned int count)
+{
+	unsigned int i;
+
+	if (count == 0)
+		return 0;
+
+	if (!g_thread_supported()) {
+		error("Threads not supported, running sessions in main loop");
+		return -ENOSYS;
+	}
+
+	main_thread = g_thread_self();
+	call_mutex = g_mutex_new();
+	call_cond = g_cond_new();
+
+	workers = g_new0(struct obex_worker, count);
+
+	for (i = 0; i < count; i++) {
+		struct obex_worker *worker = &workers[i];
+		GError *gerr = NULL;
+
+		worker->context = g_main_context_new();
+		worker->loop = g_main_loop_new(worker->context, FALSE);
+		worker->thread = g_thread_create(worker_run, worker, TRUE,
+									&gerr);
+		if (worker->thread == NULL) {
+			error("Unable to start worker: %s", gerr->message);
+			g_error_free(gerr);
+			g_main_loop_unref(worker->loop);
+			g_main_context_unref(worker->context);
+			break;
+		}
+	}
+
+	workers_count = i;
+
+	DBG("%u session workers", workers_count);
+
+	return 0;
+}
+
+/* The main loop is not running anymore: callers waiting for it are let
+ * go and new calls fail right away */
+static void fail_calls(void)
+{
+	GSList *l;
+
+	g_mutex_lock(call_mutex);
+
+	exiting = TRUE;
+
+	for (l = calls; l; l = l->next) {
+		struct main_call *call = l->data;
+
+		g_source_remove(call->id);
+		call->failed = TRUE;
+		call->done = TRUE;
+	}
+
+	g_slist_free(calls);
+	calls = NULL;
+
+	g_cond_broadcast(call_cond);
+	g_mutex_unlock(call_mutex);
+}
+
+static gboolean worker_stop(void *data)
+{
+	struct obex_worker *worker = data;
+
+	/* Sessions are torn down from the thread they run in */
+	obex_session_destroy_all(worker->context);
+
+	g_main_loop_quit(worker->loop);
+
+	return FALSE;
+}
+
+void obex_worker_exit(void)
+{
+	unsigned int i;
+
+	if (workers_count > 0)
+		fail_calls();
+
+	for (i = 0; i < workers_count; i++) {
+		struct obex_worker *worker = &workers[i];
+		GSource *source;
+
+		source = g_idle_source_new();
+		g_source_set_callback(source, worker_stop, worker, NULL);
+		g_source_attach(source, worker->context);
+		g_source_unref(source);
+
+		g_thread_join(worker->thread);
+
+		g_main_loop_unref(worker->loop);
+		g_main_context_unref(worker->context);
+	}
+
+	g_free(workers);
+	workers = NULL;
+	workers_count = 0;
+
+	if (call_mutex) {
+		g_mutex_free(call_mutex);
+		g_cond_free(call_cond);
+		call_mutex = NULL;
+		call_cond = NULL;
+	}
+}
+
+GMainContext *obex_worker_next_context(void)
+{
+	unsigned int i;
+
+	if (workers_count == 0)
+		return NULL;
+
+	i = g_atomic_int_exchange_and_add(&next_worker, 1);
+
+	return workers[i % workers_count].context;
+}
+
+gboolean obex_worker_in_main_thread(void)
+{
+	if (workers_count == 0)
+		return TRUE;
+
+	return g_thread_self() == main_thread;
+}
+
+static gboolean main_call_cb(void *user_data)
+{
+	struct main_call *call = user_data;
+
+	call->func(call->data);
+
+	g_mutex_lock(call_mutex);
+	calls = g_slist_remove(calls, call);
+	call->done = TRUE;
+	g_cond_broadcast(call_cond);
+	g_mutex_unlock(call_mutex);
+
+	return FALSE;
+}
+
+gboolean obex_worker_call_main(GSourceFunc func, void *data)
+{
+	struct main_call call = { func, data, 0, FALSE, FALSE };
+
+	if (obex_worker_in_main_thread()) {
+		func(data);
+		return TRUE;
+	}
+
+	g_mutex_lock(call_mutex);
+
+	if (exiting) {
+		g_mutex_unlock(call_mutex);
+		return FALSE;
+	}
+
+	calls = g_slist_prepend(calls, &call);
+	call.id = g_idle_add_full(G_PRIORITY_HIGH, main_call_cb, &call, NULL);
+
+	while (!call.done)
+		g_cond_wait(call_cond, call_mutex);
+
+	g_mutex_unlock(call_mutex);
+
+	return !call.failed;
+}
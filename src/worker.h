@@ -0,0 +1,35 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+int obex_worker_init(unsigned int count);
+void obex_worker_exit(void);
+
+/* Context of the next worker in turn, NULL if sessions run in main loop */
+GMainContext *obex_worker_next_context(void);
+
+gboolean obex_worker_in_main_thread(void);
+
+/* Runs func in the main loop and waits for it to return, FALSE if it
+ * could not be run because the main loop has quit */
+gboolean obex_worker_call_main(GSourceFunc func, void *data);
@@ -0,0 +1,296 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "phonebook.h"
+#include "phonenumber.h"
+#include "pbapcache.h"
+
+#define BUILD_ENTRIES 50000
+#define SEARCH_ENTRIES 100000
+#define SEARCH_ROUNDS 20
+#define LOOKUP_NUMBERS 100000
+#define LOOKUP_ROUNDS 10000
+
+static const char *first_names[] = {
+	"Anna", "\xc3\x89lodie", "Fran\xc3\xa7ois", "J\xc3\xbcrgen", "Maria",
+	"Nuno", "Olga", "Pekka", "S\xc3\xb8ren", "Zo\xc3\xab",
+};
+
+static const char *last_names[] = {
+	"Almeida", "Bj\xc3\xb6rk", "Dupont", "Garc\xc3\xad" "a", "Kowalski",
+	"M\xc3\xbcller", "Nieminen", "Rossi", "Smith", "\xc3\x98stergaard",
+};
+
+static long peak_rss(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_maxrss;
+}
+
+/* Contacts as a backend would report them, numbers in various formats */
+static void cache_fill(struct cache *cache, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		char id[32], name[64], tel[32];
+
+		snprintf(id, sizeof(id), "contact-%u", i);
+		snprintf(name, sizeof(name), "%s;%s %u",
+				last_names[i % G_N_ELEMENTS(last_names)],
+				first_names[(i / 7) % G_N_ELEMENTS(first_names)],
+				i);
+
+		switch (i % 3) {
+		case 0:
+			snprintf(tel, sizeof(tel), "+44 20 7%03u %04u",
+						(i / 10000) % 1000, i % 10000);
+			break;
+		case 1:
+			snprintf(tel, sizeof(tel), "0044 (20) 7%03u-%04u",
+						(i / 10000) % 1000, i % 10000);
+			break;
+		default:
+			snprintf(tel, sizeof(tel), "020 7%03u %04u",
+						(i / 10000) % 1000, i % 10000);
+			break;
+		}
+
+		cache_add(cache, id, PHONEBOOK_INVALID_HANDLE, name, NULL, tel);
+	}
+}
+
+static void bench_build(unsigned int count)
+{
+	struct cache cache;
+	GTimer *timer;
+	long rss;
+
+	memset(&cache, 0, sizeof(cache));
+
+	rss = peak_rss();
+	timer = g_timer_new();
+
+	cache_fill(&cache, count);
+
+	printf("build %u entries: %.1f ms, peak RSS %ld kB (+%ld kB)\n",
+				cache_size(&cache),
+				g_timer_elapsed(timer, NULL) * 1e3,
+				peak_rss(), peak_rss() - rss);
+
+	g_timer_start(timer);
+	cache_clear(&cache);
+
+	printf("clear: %.1f ms\n", g_timer_elapsed(timer, NULL) * 1e3);
+
+	g_timer_destroy(timer);
+}
+
+/* What searches cost before the keys were precomputed and indexed */
+static unsigned int scan_search(struct cache *cache, int field,
+					const char *value, guint8 *matches)
+{
+	unsigned int i, found = 0;
+
+	for (i = 0; i < cache_size(cache); i++) {
+		struct cache_entry *entry = cache_entry(cache, i);
+		char *name;
+
+		if (field == CACHE_FIELD_TEL) {
+			if (entry->tel == NULL || g_strstr_len(entry->tel, -1,
+							value) == NULL)
+				continue;
+		} else {
+			if (entry->name == NULL)
+				continue;
+
+			name = g_utf8_strdown(entry->name, -1);
+			if (strstr(name, value) == NULL) {
+				g_free(name);
+				continue;
+			}
+
+			g_free(name);
+		}
+
+		matches[i] = 1;
+		found++;
+	}
+
+	return found;
+}
+
+static void bench_query(struct cache *cache, int field, const char *value)
+{
+	unsigned int size = cache_size(cache), found, scanned, i;
+	guint8 *matches;
+	GTimer *timer;
+	double first, indexed, scan;
+
+	matches = g_new0(guint8, size);
+	timer = g_timer_new();
+
+	/* The first search of a field also builds its trigram index */
+	found = cache_search(cache, field, value, matches);
+	first = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (i = 0; i < SEARCH_ROUNDS; i++) {
+		memset(matches, 0, size);
+		cache_search(cache, field, value, matches);
+	}
+	indexed = g_timer_elapsed(timer, NULL) / SEARCH_ROUNDS;
+
+	memset(matches, 0, size);
+	g_timer_start(timer);
+	scanned = scan_search(cache, field, value, matches);
+	scan = g_timer_elapsed(timer, NULL);
+
+	printf("%s \"%s\": %u matches in %.3f ms (first %.1f ms), "
+			"scan %u matches in %.1f ms\n",
+			field == CACHE_FIELD_TEL ? "number" : "name", value,
+			found, indexed * 1e3, first * 1e3, scanned, scan * 1e3);
+
+	g_timer_destroy(timer);
+	g_free(matches);
+}
+
+static void bench_search(unsigned int count)
+{
+	struct cache cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	cache_fill(&cache, count);
+
+	printf("search %u entries:\n", cache_size(&cache));
+
+	bench_query(&cache, CACHE_FIELD_NAME, "m\xc3\xbcller");
+	bench_query(&cache, CACHE_FIELD_NAME, "rossi;anna 4");
+	bench_query(&cache, CACHE_FIELD_NAME, "elodie");
+	bench_query(&cache, CACHE_FIELD_NAME, "nobody");
+	bench_query(&cache, CACHE_FIELD_TEL, "7946");
+	bench_query(&cache, CACHE_FIELD_TEL, "020 7009 1234");
+	bench_query(&cache, CACHE_FIELD_TEL, "555");
+
+	cache_clear(&cache);
+}
+
+/* Caller lookups, each number is looked up in another format than the
+ * one it was indexed with. Every fourth one is not in the index. */
+static void bench_lookup(unsigned int count)
+{
+	struct phonenumber_index *index;
+	unsigned int i, found = 0;
+	double elapsed, slowest = 0;
+	GTimer *timer, *lookup;
+	char tel[32];
+
+	if (count == 0)
+		return;
+
+	timer = g_timer_new();
+	index = phonenumber_index_new(PHONENUMBER_MATCH_DIGITS);
+
+	for (i = 0; i < count; i++) {
+		snprintf(tel, sizeof(tel), "+1 (%03u) %03u-%04u",
+				200 + i % 700, (i / 700) % 1000, i % 10000);
+		phonenumber_index_add(index, tel, GUINT_TO_POINTER(i + 1));
+	}
+
+	printf("index %u numbers: %.1f ms\n", count,
+				g_timer_elapsed(timer, NULL) * 1e3);
+
+	lookup = g_timer_new();
+	g_timer_start(timer);
+
+	for (i = 0; i < LOOKUP_ROUNDS; i++) {
+		unsigned int n = (i * 7919) % count;
+		GSList *matches;
+
+		snprintf(tel, sizeof(tel), "001%03u%03u%04u", 200 + n % 700,
+				(n / 700) % 1000 + (i % 4 == 0 ? 1000 : 0),
+				n % 10000);
+
+		g_timer_start(lookup);
+		matches = phonenumber_index_lookup(index, tel);
+		elapsed = g_timer_elapsed(lookup, NULL);
+
+		if (elapsed > slowest)
+			slowest = elapsed;
+
+		if (matches)
+			found++;
+
+		g_slist_free(matches);
+	}
+
+	printf("%u lookups, %u found: %.2f us average, %.2f us slowest\n",
+			LOOKUP_ROUNDS, found,
+			g_timer_elapsed(timer, NULL) * 1e6 / LOOKUP_ROUNDS,
+			slowest * 1e6);
+
+	g_timer_destroy(lookup);
+	g_timer_destroy(timer);
+	phonenumber_index_free(index);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int entries = BUILD_ENTRIES;
+	unsigned int searched = SEARCH_ENTRIES;
+	unsigned int numbers = LOOKUP_NUMBERS;
+
+	if (argc > 1)
+		entries = strtoul(argv[1], NULL, 10);
+
+	if (argc > 2)
+		searched = strtoul(argv[2], NULL, 10);
+
+	if (argc > 3)
+		numbers = strtoul(argv[3], NULL, 10);
+
+	bench_build(entries);
+	bench_search(searched);
+	bench_lookup(numbers);
+
+	return 0;
+}
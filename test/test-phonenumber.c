@@ -0,0 +1,139 @@
+/*
+ *
+ *  OBEX Server
+ *
+ *  Copyright (C) 2009-2010  Intel Corporation
+ *  Copyright (C) 2007-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "phonenumber.h"
+#include "normalize.h"
+
+static void check_key(char *(*normalize)(const char *), const char *str,
+							const char *expected)
+{
+	char *key = normalize(str);
+
+	g_assert_cmpstr(key, ==, expected);
+
+	g_free(key);
+}
+
+static void test_normalize_text(void)
+{
+	check_key(normalize_text, "Elodie", "elodie");
+	check_key(normalize_text, "\xc3\x89lodie", "elodie");
+	check_key(normalize_text, "ZO\xc3\x8b", "zoe");
+	check_key(normalize_text, "Fran\xc3\xa7ois M\xc3\xbcller",
+							"francois muller");
+
+	/* Not UTF-8, only ASCII letters are folded */
+	check_key(normalize_text, "\xe9LODIE", "\xe9lodie");
+}
+
+static void test_normalize_number(void)
+{
+	check_key(normalize_number, "+44 (20) 7946-0000", "442079460000");
+	check_key(normalize_number, "112", "112");
+	check_key(normalize_number, "n/a", "");
+}
+
+static void test_phonenumber_normalize(void)
+{
+	check_key(phonenumber_normalize, "+44 20 7946 0000", "442079460000");
+	check_key(phonenumber_normalize, "0044 (20) 7946-0000",
+							"442079460000");
+	check_key(phonenumber_normalize, "tel: +44 20 7946 0000",
+							"442079460000");
+	check_key(phonenumber_normalize, "020 7946 0000", "2079460000");
+	check_key(phonenumber_normalize, "112", "112");
+	check_key(phonenumber_normalize, "", "");
+}
+
+static void check_lookup(struct phonenumber_index *index, const char *number,
+					const char *first, const char *second)
+{
+	GSList *matches = phonenumber_index_lookup(index, number);
+	GSList *l = matches;
+
+	if (first) {
+		g_assert(l != NULL);
+		g_assert_cmpstr(l->data, ==, first);
+		l = l->next;
+	}
+
+	if (second) {
+		g_assert(l != NULL);
+		g_assert_cmpstr(l->data, ==, second);
+		l = l->next;
+	}
+
+	g_assert(l == NULL);
+
+	g_slist_free(matches);
+}
+
+static void test_phonenumber_index(void)
+{
+	struct phonenumber_index *index;
+
+	index = phonenumber_index_new(PHONENUMBER_MATCH_DIGITS);
+
+	phonenumber_index_add(index, "+44 20 7946 0000", "london");
+	phonenumber_index_add(index, "+1 555 010 0000", "fictional");
+	phonenumber_index_add(index, "112", "emergency");
+	phonenumber_index_add(index, "2079460000", "national");
+	phonenumber_index_add(index, "", "empty");
+
+	/* International, national and "00" forms of the same number */
+	check_lookup(index, "+44 20 7946 0000", "london", "national");
+	check_lookup(index, "0044 20 7946 0000", "london", "national");
+	check_lookup(index, "020 7946 0000", "london", "national");
+
+	/* Same trailing digits, different numbers */
+	check_lookup(index, "+44 20 7010 0000", NULL, NULL);
+	check_lookup(index, "+1 555 010 0000", "fictional", NULL);
+
+	/* Numbers shorter than the key */
+	check_lookup(index, "112", "emergency", NULL);
+	check_lookup(index, "12", NULL, NULL);
+
+	check_lookup(index, "", NULL, NULL);
+	check_lookup(index, "unknown", NULL, NULL);
+
+	phonenumber_index_free(index);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/normalize/text", test_normalize_text);
+	g_test_add_func("/normalize/number", test_normalize_number);
+	g_test_add_func("/phonenumber/normalize", test_phonenumber_normalize);
+	g_test_add_func("/phonenumber/index", test_phonenumber_index);
+
+	return g_test_run();
+}